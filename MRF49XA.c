@@ -11,8 +11,13 @@
 #include "MRF49XA.h"
 #include "spi.h"
 #include "hamming.h"
+#include "rs8.h"
+#include "golay.h"
 
+#include <string.h>
 #include <util/delay.h>
+#include <util/crc16.h>
+#include <avr/boot.h>
 
 // Bit position:   7  6  5  4  3  2  1  0
 // Normal modes:                 <X  X  X>
@@ -22,6 +27,7 @@
 #define MRF_IDLE			0x00	// Listening for packets, nothing yet
 #define MRF_TRANSMIT_PACKET 0x01	// Actively transmitting a packet
 #define MRF_RECEIVE_PACKET  0x02	// Actively receiving a packet
+#define MRF_RECEIVE_HEADER  0x03	// Have the length, waiting for the type
 
 // Testing modes
 #define MRF_RECEIVE_ALL		0x20	// Not yet implemented
@@ -34,47 +40,254 @@
 static volatile uint8_t mrf_state;	// Defaults to idle
 static volatile uint8_t mrf_alive;	// Set to '1' by ISR
 
-volatile uint8_t packetCounter;
+// Packets waiting to be transmitted are kept in a circular buffer exactly
+// as they go on the air (preamble, sync, length, type, coded payload and the
+// trailing dummy byte), each preceded by a byte giving its on-air length.
+// All of the encoding happens in MRF_transmit_packet(), so the ISR only has
+// to write the next byte out.
+//
+// Each frame in the buffer has an entry in the frame table, which records
+// where it starts and what's left to do with it.  Frames are sent oldest
+// first, but a frame can be kept after it's sent (for retransmission) and
+// sent again, so the space is only reclaimed, oldest first, once a frame
+// has nothing left to do.  Main is the only writer of tx_in, tx_head and
+// tx_tail, and only changes frame flags with interrupts masked.
+#define TX_FRAME_SEND   0x01    // Waiting to go on the air
+#define TX_FRAME_AIR    0x02    // On the air right now
+#define TX_FRAME_KEEP   0x04    // Keep after sending, until released
+#define TX_FRAME_FIRST  0x08    // Goes ahead of anything else waiting
 
-// There are 2 Rx_Packet_t instances, one for reading off the air
-// and one for processing back in main. (double buffering)
-MRF_packet_t Rx_Packet_a;
-MRF_packet_t Rx_Packet_b;
-MRF_packet_t Tx_packet;
+static uint8_t tx_buf[MRF_TX_BUFFER_LEN];
+static uint8_t tx_frame_start[MRF_TX_FRAMES];   // Index of the length byte
+static volatile uint8_t tx_frame_flags[MRF_TX_FRAMES];
+static volatile uint8_t tx_head;        // Next free frame entry (main)
+static volatile uint8_t tx_tail;        // Oldest entry using space (main)
+static uint8_t tx_in;                   // Next free byte (main)
+static uint8_t tx_out;                  // Next byte to send (ISR)
+static uint8_t tx_frame;                // Entry on the air (ISR)
+static uint8_t tx_remaining;            // Bytes left in the frame on the air
+static uint8_t tx_burst;                // Frames sent since the transmitter came on
+static uint8_t tx_csma;                 // Listen before talk, see MRF_CSMA_TRIES
+static uint8_t tx_csma_tries;           // Busy checks for the next frame
+static uint8_t tx_backoff;              // Ticks until we listen again
+static uint16_t tx_random = 1;          // Backoff LFSR, seeded in MRF_init()
+static uint8_t tx_window = MRF_TX_WINDOW_OPEN;  // Ticks left to start frames in
+static uint8_t tx_window_len;           // What it was opened with
 
-// The hasPacket flag means that the finished_packet variable contains
-// a fresh data packet.  The receiving_packet always contains space for
-// received data.  If finished_packet isn't read before the a second packet
-// comes the contents are lost
-volatile uint8_t	hasPacket;		// Initialized to 0 by default
-volatile MRF_packet_t *finished_packet;
+static void tx_start(void);
+
+// Received packets are kept in a ring of MRF_RX_RING_LEN slots.  The ISR is
+// the only writer of rx_head, and main is the only writer of rx_tail, so the
+// ring doesn't need any locking.  Both are free-running counters, the slot
+// index is the counter masked with the ring size.  The slot returned by
+// MRF_receive_packet() belongs to main until the next call, so rx_tail isn't
+// advanced past it until then.  If every slot is full when a new packet
+// starts, the new packet is dropped and counted rather than overwriting one.
+MRF_packet_t Rx_ring[MRF_RX_RING_LEN];
+static volatile uint8_t rx_head;    // Slot the ISR is filling
+static volatile uint8_t rx_tail;    // Oldest slot not yet released by main
+static uint8_t rx_held;             // Main has the rx_tail slot checked out
 volatile MRF_packet_t *receiving_packet;
 
+// Receive state for the packet on the air.  This is set up once, from the
+// header, so that the work done per payload byte is small and the same for
+// every byte.
+static uint8_t *rx_ptr;             // Where the next payload byte goes
+static uint8_t  rx_remaining;       // Payload bytes left to come off the air
+static uint8_t  rx_ecc;             // Payload is hamming coded, a nibble a byte
+static uint8_t  rx_phase;           // 1 when the next nibble is the high one
+static uint8_t  rx_erased;          // The byte being put together is a guess
+static uint8_t  rx_mark;            // Replace those with MRF_ERASURE_MARK
+
+// The interleaver, see MRF_INTERLEAVE_MAX.  The receive side collects a
+// block of bits and passes the coded bytes on once it has all of them.
+// The transmit side collects its block in place in tx_buf.
+static uint8_t  il_depth = MRF_INTERLEAVE_DEFAULT;
+static uint8_t  rx_il;              // The bytes coming are in an interleaved block
+static uint8_t  rx_il_block[MRF_INTERLEAVE_MAX];
+static uint8_t  rx_il_count;        // Bytes of the block received
+static uint8_t  rx_il_byte;         // Where the next bit goes
+static uint8_t  rx_il_bit;
+static uint8_t  tx_il_start;        // Where the block starts in tx_buf (main)
+static uint8_t  tx_il_count;        // Coded bytes waiting in the block (main)
+static uint8_t  tx_il_blocks;       // Whole blocks left in the frame (main)
+
+// Whitening sequences, see MRF_WHITEN_SEED
+static uint8_t  rx_whiten;
+static uint16_t rx_pn9;
+static uint8_t  tx_whiten;          // (main)
+static uint16_t tx_pn9;
+
+// The coded header, see MRF_HEADER_CODED_EXTRA
+static uint8_t  hdr_coded;
+static uint8_t  rx_hdr_count;       // Coded header bytes received
+static uint8_t  rx_hdr_low;         // The low nibble of the byte being decoded
+
+// Frame options (PACKET_FLAG_*) added to the type of every packet we send,
+// and the forward error correction for packets that don't ask for any
+static uint8_t tx_flags;
+static uint8_t tx_fec;
+static uint8_t tx_whiten_types;
+
+// A frame that stops short (a fade or a collision) would leave us consuming
+// noise until the announced length ran out.  So each frame gets a deadline,
+// counted down by MRF_tick(), long enough for the announced length to
+// arrive at the configured bit rate.  If it runs out first, the frame is
+// dropped and we go back to looking for a sync pattern.
+//
+// The byte time is kept in units of 1/64 tick (128 uS) so the deadline is
+// an 8 bit multiply.  A DRSREG byte takes 23.2 * (DRPV + 1) * (1 + 7 * DRPE)
+// uS, which is 29 * (DRPV + 1) * (1 + 7 * DRPE) / 160 units, rounded up.
+#define RX_BYTE_TIME(drsreg)    ((29 * (uint16_t)(((drsreg) & MRF_DRPV_MASK) + 1) *   \
+                                  (((drsreg) & MRF_DRPE) ? 8 : 1) + 159) / 160)
+#define RX_TIMEOUT_SLACK        2   // Ticks, covers the tick phase and jitter
+
+static uint8_t rx_byte_time = RX_BYTE_TIME(MRF_DRSREG | MRF_DRPV_VALUE);
+static volatile uint16_t rx_ticks;  // Ticks left for the frame, 0 if none
+
+// Counters for the host, see MRF_get_stats().  MRF_NO_STATS leaves them
+// out of the build, for the RAM.
+#ifndef MRF_NO_STATS
+static volatile MRF_stats_t mrf_stats;
+
+#define STAT_COUNT(counter)     (mrf_stats.counter++)
+#define STAT_ADD(counter, n)    (mrf_stats.counter += (n))
+#define STAT_MAX(counter, n)    do { if ((n) > mrf_stats.counter) {  \
+                                         mrf_stats.counter = (n); } } while (0)
+#else
+#define STAT_COUNT(counter)
+#define STAT_ADD(counter, n)    ((void)(n))
+#define STAT_MAX(counter, n)    ((void)(n))
+#endif
+
 volatile uint16_t	mrf_status;
 
 static volatile uint8_t fiforstregUser = MRF_DRSTM;
 
 #define RegisterSet(setting) spi_write16(setting, 0xFFFF, &MRF_CS_PORTx, MRF_CS_BIT)
 
-extern volatile uint8_t mutex;
+// The configuration registers are write-only, so we keep a copy of the last
+// value written to each of them.  RegisterUpdate() skips the SPI transaction
+// if the register already holds the value.  Commands that aren't
+// configuration registers (status read, FIFO read and TX byte writes) are
+// always sent.  The shadows start out as 0, which isn't a valid command for
+// any of these registers, so the first write always goes through.
+enum mrf_shadow_index {
+    SHADOW_GENCREG,
+    SHADOW_PMCREG,
+    SHADOW_CFSREG,
+    SHADOW_TXCREG,
+    SHADOW_RXCREG,
+    SHADOW_AFCCREG,
+    SHADOW_BBFCREG,
+    SHADOW_DRSREG,
+    SHADOW_FIFORSTREG,
+    SHADOW_SYNBREG,
+    SHADOW_PLLCREG,
+    SHADOW_WTSREG,
+    SHADOW_DCSREG,
+    SHADOW_CSREG,
+    SHADOW_COUNT,
+    SHADOW_NONE = 0xFF
+};
+
+static uint16_t mrf_shadow[SHADOW_COUNT];
+
+// The register is selected by a variable number of high-order bits
+static uint8_t shadow_index(uint16_t command)
+{
+    uint8_t high = command >> 8;
+    
+    if ((high & 0xF0) == 0xA0) return SHADOW_CFSREG;    // 1010 xxxx
+    if ((high & 0xE0) == 0xE0) return SHADOW_WTSREG;    // 111x xxxx
+    if ((high & 0xF8) == 0x90) return SHADOW_RXCREG;    // 1001 0xxx
+    if ((high & 0xFE) == 0x98) return SHADOW_TXCREG;    // 1001 100x
+    
+    switch (high) {
+        case 0x80: return SHADOW_GENCREG;
+        case 0x82: return SHADOW_PMCREG;
+        case 0xC0: return SHADOW_CSREG;
+        case 0xC2: return SHADOW_BBFCREG;
+        case 0xC4: return SHADOW_AFCCREG;
+        case 0xC6: return SHADOW_DRSREG;
+        case 0xC8: return SHADOW_DCSREG;
+        case 0xCA: return SHADOW_FIFORSTREG;
+        case 0xCC: return SHADOW_PLLCREG;
+        case 0xCE: return SHADOW_SYNBREG;
+        default:   return SHADOW_NONE;
+    }
+}
+
+static void RegisterUpdate(uint16_t setting)
+{
+    uint8_t index = shadow_index(setting);
+    
+    if (index != SHADOW_NONE) {
+        if (mrf_shadow[index] == setting) {
+            STAT_COUNT(regWritesSkipped);
+            return;
+        }
+        
+        mrf_shadow[index] = setting;
+    }
+    
+    RegisterSet(setting);
+}
+
+// The IRO ISR and main context share the SPI bus.  If the ISR fired in the
+// middle of one of main's transactions it would take over the chip select
+// and the read buffer, so everything main does with the transceiver is done
+// with interrupts masked.  These sections are only a few register writes
+// long.  An IRO edge that arrives in the meantime stays pending and is
+// serviced as soon as interrupts are restored, those are counted so we can
+// see how often the foreground delays the ISR.
+//
+// These are harmless in the ISR (interrupts stay disabled), so functions
+// like MRF_reset() can be used from either context.
+static inline uint8_t mrf_lock(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    return sreg;
+}
+
+static inline void mrf_unlock(uint8_t sreg)
+{
+    if ((sreg & (1 << SREG_I)) && MRF_INT_PENDING()) {
+        STAT_COUNT(spiDeferred);
+    }
+    
+    SREG = sreg;
+}
 
 void MRF_registerSet(uint16_t value)
 {
     // We need to detect whether the FIFORSTREG is being set.  There are user
     // flags and core flags in the same register, therefore, we need to save
     // the user parts of it, and bitwise-OR them with the core flags.
-    if (value & 0xFF00 == MRF_FIFORSTREG) {
+    if ((value & 0xFF00) == MRF_FIFORSTREG) {
         fiforstregUser = value & (MRF_DRSTM | MRF_SYCHLEN); // Filter-out all but the user fields
         return;
     }
     
-    RegisterSet(value);
+    uint8_t sreg = mrf_lock();
+    RegisterUpdate(value);
+    
+    // Receive deadlines depend on the bit rate
+    if ((value & 0xFF00) == MRF_DRSREG) {
+        rx_byte_time = RX_BYTE_TIME(value);
+    }
+    mrf_unlock(sreg);
 }
 
 uint16_t MRF_statusRead(void)
 {
+    uint8_t sreg = mrf_lock();
     spi_write16(0x0000, 0xFFFF, &MRF_CS_PORTx, MRF_CS_BIT);
-    return spi_read16();
+    uint16_t status = spi_read16();
+    mrf_unlock(sreg);
+    
+    return status;
 }
 
 static inline uint8_t MRF_fifo_read(void)
@@ -83,192 +296,572 @@ static inline uint8_t MRF_fifo_read(void)
 	return spi_read8();
 }
 
+// Restart the search for the sync pattern.  The receiver is left running,
+// this is all that's needed after noise, or at the end of a packet.
+static inline void fifo_resync(void)
+{
+	RegisterUpdate(MRF_FIFOSTREG_SET | fiforstregUser);
+	RegisterUpdate(MRF_FIFOSTREG_SET | fiforstregUser | MRF_FSCF);
+}
+
+// Put the transceiver back into receive mode, waiting for a sync pattern.
+// Thanks to the shadow registers, when we're already receiving this
+// is just the FIFO resync.
 void MRF_reset(void)
 {
-	RegisterSet(MRF_PMCREG);
-	RegisterSet(MRF_FIFOSTREG_SET | fiforstregUser);
-	RegisterSet(MRF_GENCREG_SET);
-	RegisterSet(MRF_GENCREG_SET | MRF_FIFOEN);
-	RegisterSet(MRF_FIFOSTREG_SET | MRF_FSCF | fiforstregUser);
-	RegisterSet(MRF_PMCREG | MRF_RXCEN);	
+    uint8_t sreg = mrf_lock();
+    
+	RegisterUpdate(MRF_PMCREG | MRF_RXCEN);
+	RegisterUpdate(MRF_GENCREG_SET | MRF_FIFOEN);
+    fifo_resync();
 
-    mrf_status = MRF_IDLE;
+    // A frame cut off part way is given up on (a retained one can be resent)
+    if (mrf_state == MRF_TRANSMIT_PACKET) {
+        tx_frame_flags[tx_frame] &= ~TX_FRAME_AIR;
+    }
+    
+    mrf_state = MRF_IDLE;
     LED_PORTx &= ~(1 << LED_RX) & ~(1 << LED_TX);
+    
+    // Anything else waiting can go
+    tx_start();
+    
+    mrf_unlock(sreg);
+}
+
+// The next 8 bits of the whitening sequence
+static inline uint8_t pn9_next(uint16_t *state)
+{
+    uint16_t pn9 = *state;
+    uint8_t  out = pn9 & 0xFF;
+    uint8_t  i;
+    
+    for (i = 0; i < 8; i++) {
+        pn9 = (pn9 >> 1) | (((pn9 ^ (pn9 >> 5)) & 1) << 8);
+    }
+    
+    *state = pn9;
+    return out;
+}
+
+// Give up on the frame being received, and go back to looking for sync
+static void rx_abort(void)
+{
+    fifo_resync();
+    rx_ticks  = 0;
+    mrf_state = MRF_IDLE;
+    LED_PORTx &= ~(1 << LED_RX);
+}
+
+// Set the deadline for the rest of a frame of this many bytes
+static void rx_deadline(uint8_t bytes)
+{
+    // At the slowest rate a whole frame is around 400 ticks (3.3 S), so
+    // this takes 16 bits.  Only the IRO ISR and MRF_tick() (which holds
+    // the radio lock) touch it, so it doesn't need anything more.
+    rx_ticks = ((uint16_t)bytes * rx_byte_time >> 6) + RX_TIMEOUT_SLACK;
+}
+
+// We don't know the type yet, so allow for an ECC payload and frame check
+// (twice the length), Reed-Solomon parity and the type byte (or two)
+static inline void rx_size_deadline(uint8_t size)
+{
+    rx_deadline(((size + MRF_FCS_LEN) << 1) + MRF_RS_LEN + 1 + hdr_coded);
 }
 
 static inline void idle_ISR(void)
 {
     uint8_t bl = MRF_fifo_read();
 
-    // The first byte is the packet payload length, make sure it's sensical
-    if (bl <= MRF_PAYLOAD_LEN && bl > 0) {
-        mrf_state  = MRF_RECEIVE_PACKET;
-        LED_PORTx |= (1 << LED_RX);
-
-        receiving_packet->payloadSize = bl;
-        for (int i = 0; i < bl; i++) {
-            receiving_packet->payload[i] = 0;   // Clean the previous payload
+    // The first byte is the packet payload length, make sure it's sensical.
+    // A coded header's first byte only has to decode, the size is checked
+    // once both nibbles are in.
+    if (hdr_coded) {
+        uint8_t code = hamming_decode_nibble_status(bl);
+        if (code & HAMMING_ERASED) {
+            fifo_resync();
+            return;
         }
         
-        // We've received 1 byte
-        packetCounter = 1;
+        rx_hdr_low   = code & 0x0F;
+        rx_hdr_count = 1;
     }
     
-    // The length doesn't make sense, so reset
-    else {
+    else if (bl > MRF_PAYLOAD_LEN || bl == 0) {
+        // The length doesn't make sense, it was probably noise.  We're still
+        // in receive mode, so only the sync pattern search needs restarting.
         LED_PORTx &= ~(1 << LED_RX);
-        packetCounter = 0;
-        MRF_reset();
+        fifo_resync();
         return;
     }
+    
+    // If main hasn't released any slots there is nowhere to put it
+    if ((uint8_t)(rx_head - rx_tail) >= MRF_RX_RING_LEN) {
+        STAT_COUNT(rxOverflow);
+        fifo_resync();
+        return;
+    }
+
+    mrf_state  = MRF_RECEIVE_HEADER;
+    LED_PORTx |= (1 << LED_RX);
+
+    receiving_packet = &Rx_ring[rx_head & MRF_RX_RING_MASK];
+    receiving_packet->payloadSize = bl;
+    
+    // The signal strength is only worth anything while the frame is on
+    RegisterSet(MRF_STSREG);
+    receiving_packet->rssi = (spi_read16() & MRF_ATTRSSI) != 0;
+    
+    // Only the rest of the coded header is due, until we know the size
+    if (hdr_coded) {
+        rx_deadline(MRF_HEADER_CODED_EXTRA + 1);
+    } else {
+        rx_size_deadline(bl);
+    }
 }
 
-static inline void xmit_ISR(void)
+// The next byte of a coded header.  Returns the size or type byte once both
+// of its nibbles are in, or -1 if there's more to come (or it was dropped).
+static inline int16_t rx_header_coded(uint8_t bl)
 {
-    uint8_t maxPacketCounter = 0;
+    uint8_t code = hamming_decode_nibble_status(bl);
     
-    // ECC payloads are twice as large as advertised
-    if (Tx_packet.type == PACKET_TYPE_SERIAL_ECC ||
-        Tx_packet.type == PACKET_TYPE_PACKET_ECC) {
-        maxPacketCounter = (Tx_packet.payloadSize * 2) + MRF_TX_PACKET_OVERHEAD;
-    } else {
-        maxPacketCounter = Tx_packet.payloadSize + MRF_TX_PACKET_OVERHEAD;
+    if (code & HAMMING_ERASED) {
+        STAT_COUNT(rxHeaderError);
+        rx_abort();
+        return -1;
     }
     
-    // Test whether we're done transmitting
-    if (packetCounter >= maxPacketCounter) {
-        // Disable transmitter, enable receiver
-        RegisterSet(MRF_PMCREG | MRF_RXCEN);
-        RegisterSet(MRF_GENCREG_SET | MRF_FIFOEN);
-        RegisterSet(MRF_FIFOSTREG_SET | fiforstregUser);
-        RegisterSet(MRF_FIFOSTREG_SET | fiforstregUser | MRF_FSCF);
+    if (code & HAMMING_CORRECTED) {
+        STAT_COUNT(rxFecCorrected);
+    }
+    
+    // The low nibble of the size came in idle_ISR(), so even counts are
+    // low nibbles
+    if ((rx_hdr_count++ & 1) == 0) {
+        rx_hdr_low = code & 0x0F;
+        return -1;
+    }
+    
+    bl = rx_hdr_low | (code << 4);
+    if (rx_hdr_count != 2) {
+        return bl;
+    }
+    
+    // The size
+    if (bl > MRF_PAYLOAD_LEN || bl == 0) {
+        STAT_COUNT(rxHeaderError);
+        rx_abort();
+        return -1;
+    }
+    
+    receiving_packet->payloadSize = bl;
+    rx_size_deadline(bl);
+    return -1;
+}
+
+// The oldest frame waiting to go (unless one has to go first), tx_head if
+// there isn't one
+static uint8_t tx_waiting(void)
+{
+    uint8_t i, oldest = tx_head;
+    
+    for (i = tx_tail; i != tx_head; i++) {
+        uint8_t flags = tx_frame_flags[i & MRF_TX_FRAMES_MASK];
         
-        // Return the state
-        mrf_state = MRF_IDLE;
-        LED_PORTx &= ~(1 << LED_TX);
-        packetCounter = 0;
+        if ((flags & (TX_FRAME_SEND | TX_FRAME_FIRST)) == (TX_FRAME_SEND | TX_FRAME_FIRST)) {
+            return i;
+        }
+        
+        if ((flags & TX_FRAME_SEND) && oldest == tx_head) {
+            oldest = i;
+        }
     }
     
-    switch (packetCounter) {
-        case 0:         // First byte is 'AA' for a alternating tone
-            RegisterSet(MRF_TXBREG | 0x00AA);
-            break;
-        case 1:         // First of two synchronization bytes
-            RegisterSet(MRF_TXBREG | 0x002D);
-            break;
-        case 2:         // Second of two synchronization bytes
-            RegisterSet(MRF_TXBREG | 0x00D4);
-            break;
-        case 3:         // Size byte
-            RegisterSet(MRF_TXBREG | Tx_packet.payloadSize);
-            break;
-        case 4:         // Type byte
-            RegisterSet(MRF_TXBREG | Tx_packet.type);
-            break;
-            
-        default:        // Payload
-            // It matters which mode we're in.
-            // If we're in an ECC mode, we transmit hamming-coded
-            // high-nibbles on high-packet
-            if (Tx_packet.type == PACKET_TYPE_SERIAL_ECC ||
-                Tx_packet.type == PACKET_TYPE_PACKET_ECC) {
-                
-                // Calculate the payload byte we're using (divide by 2)
-                uint8_t payloadByte = Tx_packet.payload[(packetCounter - 5) >> 1];
-
-                // If the payload index is odd, we're transmitting the high nibble
-                if ((packetCounter - 5) & 0x01) {
-                    RegisterSet(MRF_TXBREG | hamming_encode_nibble(payloadByte >> 4));
-                }
-
-                // Otherwise, it's the low nibble
-                else {
-                    RegisterSet(MRF_TXBREG | hamming_encode_nibble(payloadByte & 0x0F));
-                }
-                
-            } else {
-                // The 5 is from the preamble, 2 sync bytes, size and type bytes.
-                // Later, we'll need to include ECC calculation here.
-                RegisterSet(MRF_TXBREG | Tx_packet.payload[packetCounter - 5]);
-            }
+    return oldest;
+}
+
+// Whether a frame can go in what's left of the transmit window.  One too
+// long for the whole window is sent at the start of it anyway.
+static uint8_t tx_fits(uint8_t i)
+{
+    if (tx_window == MRF_TX_WINDOW_OPEN) {
+        return 1;
+    }
+    
+    uint8_t  length = tx_buf[tx_frame_start[i & MRF_TX_FRAMES_MASK]];
+    uint16_t air    = ((uint16_t)length * rx_byte_time >> 6) + 1;
+    
+    return air <= tx_window || (tx_window != 0 && tx_window == tx_window_len);
+}
+
+// Where the unit's serial number is in the signature row (the same place
+// LUFA reads its internal serial from)
+#define MRF_SERIAL_START    0x0E
+#define MRF_SERIAL_LEN      10
+
+// The next 8 bits from the backoff LFSR, x^16 + x^14 + x^13 + x^11 + 1
+static uint8_t backoff_random(void)
+{
+    for (uint8_t i = 0; i < 8; i++) {
+        uint8_t lsb = tx_random & 0x01;
+        tx_random >>= 1;
+        if (lsb) {
+            tx_random ^= 0xB400;
+        }
+    }
+    
+    return (uint8_t)tx_random;
+}
+
+// Seed the backoff LFSR.  Dongles powered from the same hub come up in
+// step, so their timers are no good for this.  The serial number is
+// different on every chip, and the AFC offset and data quality bits of
+// the status word wander with the receiver noise.
+static void backoff_seed(void)
+{
+    uint16_t seed = 0;
+    
+    for (uint8_t i = 0; i < MRF_SERIAL_LEN; i++) {
+        seed = (seed << 3) ^ (seed >> 13) ^ boot_signature_byte_get(MRF_SERIAL_START + i);
+    }
+    
+    for (uint8_t i = 0; i < 16; i++) {
+        _delay_us(100);
+        seed = (seed << 3) ^ (seed >> 13) ^
+               (MRF_statusRead() & (MRF_DQDO | MRF_OFFSV | MRF_OFFSET_MASK));
+    }
+    
+    // An LFSR stuck at zero stays there
+    tx_random = seed ? seed : 1;
+}
+
+// Whether the channel is free to send on, see MRF_CSMA_TRIES.  If it isn't,
+// this sets the backoff.
+static uint8_t csma_clear(void)
+{
+    RegisterSet(MRF_STSREG);
+    if (!(spi_read16() & (MRF_ATTRSSI | MRF_DQDO))) {
+        tx_csma_tries = 0;
+        return 1;
+    }
+    
+    if (++tx_csma_tries > MRF_CSMA_TRIES) {
+        STAT_COUNT(csmaForced);
+        tx_csma_tries = 0;
+        return 1;
+    }
+    
+    uint8_t be = MRF_CSMA_BE_MIN + tx_csma_tries - 1;
+    if (be > MRF_CSMA_BE_MAX) {
+        be = MRF_CSMA_BE_MAX;
+    }
+    
+    tx_backoff = 1 + (backoff_random() & ((1 << be) - 1));
+    STAT_COUNT(csmaBusy);
+    return 0;
+}
+
+// Put the oldest frame waiting to go on the air, returns 0 if there isn't
+// one.  This must be called with interrupts disabled (or from the ISR)
+static uint8_t tx_next_frame(void)
+{
+    uint8_t i = tx_waiting();
+    
+    if (i == tx_head || !tx_fits(i)) {
+        return 0;
+    }
+    
+    tx_frame = i & MRF_TX_FRAMES_MASK;
+    tx_frame_flags[tx_frame] = (tx_frame_flags[tx_frame] & ~(TX_FRAME_SEND | TX_FRAME_FIRST)) |
+                               TX_FRAME_AIR;
+
+    // The first byte of each frame is its length
+    tx_out = tx_frame_start[tx_frame];
+    tx_remaining = tx_buf[tx_out];
+    if (++tx_out == MRF_TX_BUFFER_LEN) {
+        tx_out = 0;
+    }
+    
+    return 1;
+}
+
+// Start sending the oldest frame waiting to go, if the radio is free.
+// This must be called with interrupts disabled (or from the ISR)
+static void tx_start(void)
+{
+    if (mrf_state != MRF_IDLE || tx_backoff) {
+        return;
+    }
+    
+    // Only listen if there's something to send, and time to send it
+    uint8_t i = tx_waiting();
+    if (i == tx_head || !tx_fits(i)) {
+        return;
+    }
+    
+    if (tx_csma && !csma_clear()) {
+        return;
+    }
+    
+    tx_next_frame();
+    
+    mrf_state = MRF_TRANSMIT_PACKET;
+    LED_PORTx |= (1 << LED_TX);
+    tx_burst = 1;
+
+	RegisterUpdate(MRF_PMCREG);                    // Turn everything off
+	RegisterUpdate(MRF_GENCREG_SET | MRF_TXDEN);   // Enable TX FIFO
+	// Reset value of TX FIFO is 0xAAAA
+	
+	RegisterUpdate(MRF_PMCREG | MRF_TXCEN);        // Begin transmitting
+	// Everything else is handled in the ISR
+}
+
+// Frames waiting to go are sent back to back, with the transmitter left on.
+// Each one still has its own preamble, sync and length, so the receiver
+// treats them as separate frames, but they don't pay for the transmitter
+// turning off and on again (and the synthesizer settling) in between.
+// After MRF_TX_BURST_MAX frames we go back to receiving, and whatever is
+// left waits for the next tick, which gives the other side a gap to start
+// a frame of its own in.
+static inline void xmit_ISR(void)
+{
+    // Test whether we're done transmitting
+    if (tx_remaining == 0) {
+        STAT_COUNT(txComplete);
+        tx_frame_flags[tx_frame] &= ~TX_FRAME_AIR;
+        
+        // Straight on to the next frame, the last one's dummy byte is still
+        // going out
+        if (tx_burst < MRF_TX_BURST_MAX && tx_next_frame()) {
+            tx_burst++;
+            STAT_COUNT(txChained);
+        } else {
+            // Disable transmitter, enable receiver
+            RegisterUpdate(MRF_PMCREG | MRF_RXCEN);
+            RegisterUpdate(MRF_GENCREG_SET | MRF_FIFOEN);
+            fifo_resync();
             
-            break;
+            // Return the state
+            mrf_state = MRF_IDLE;
+            LED_PORTx &= ~(1 << LED_TX);
+            return;
+        }
+    }
+    
+    // The frame was encoded when it was queued, just send the next byte
+    RegisterSet(MRF_TXBREG | tx_buf[tx_out]);
+    if (++tx_out == MRF_TX_BUFFER_LEN) {
+        tx_out = 0;
     }
     
-    packetCounter += 1;
+    tx_remaining--;
 }
 
 // If this ISR function is called, we've recieved the payload length and nothing else
-static inline void rx_ISR(void)
+static inline void rx_header_ISR(void)
 {
 	uint8_t bl = MRF_fifo_read();
     
-    if (packetCounter == 1) {
-        // We're recieving the type field
-        receiving_packet->type = bl;
-        packetCounter++;
+    if (hdr_coded) {
+        int16_t value = rx_header_coded(bl);
+        if (value < 0) {
+            return;
+        }
+        
+        bl = value;
+    }
+    
+    // We're recieving the type field, now we know whether it's ECC (2x the
+    // size) and whether there's a frame check.  The frame check lands
+    // right after the payload (the fcs field makes room for it when the
+    // payload is full).
+    uint8_t size = receiving_packet->payloadSize;
+    
+    receiving_packet->type = bl;
+    if (bl & PACKET_FLAG_CRC) {
+        size += MRF_FCS_LEN;
+    }
+    
+    // The parity follows the frame check, and is corrected later
+    if (PACKET_IS_RS(bl)) {
+#ifdef MRF_NO_RS
+        rx_abort();
         return;
+#else
+        size += RS_NROOTS;
+#endif
+    }
+    
+    // So are the Golay codewords, which are stored as they come in
+    if (PACKET_IS_GOLAY(bl)) {
+        if (size > MRF_GOLAY_MAX) {
+            rx_abort();
+            return;
+        }
+        size = GOLAY_CODED_LEN(size);
     }
     
-    // We've got the type field, so we know whether it's ECC, and 2x the size
-    uint8_t maxPacketCounter = receiving_packet->payloadSize + MRF_PACKET_OVERHEAD;
-    if (receiving_packet->type == PACKET_TYPE_SERIAL_ECC ||
-        receiving_packet->type == PACKET_TYPE_PACKET_ECC) {
-        maxPacketCounter = (receiving_packet->payloadSize * 2) + MRF_PACKET_OVERHEAD;
+    rx_ecc = PACKET_IS_HAMMING(bl);
+    rx_remaining = size << rx_ecc;
+    rx_il    = (bl & PACKET_FLAG_INTERLEAVE) && rx_remaining >= il_depth;
+    rx_whiten = bl & PACKET_FLAG_WHITEN;
+    rx_pn9   = MRF_WHITEN_SEED;
+    rx_il_count = 0;
+    rx_ptr   = (uint8_t *)receiving_packet->payload;
+    rx_phase = 0;
+    rx_erased = 0;
+    receiving_packet->fecCorrected = 0;
+    receiving_packet->fecErased    = 0;
+    
+    mrf_state = MRF_RECEIVE_PACKET;
+}
+
+// The packet is complete, hand it to main
+static void rx_finish(void)
+{
+    // Reset the FIFO
+    fifo_resync();
+    rx_ticks = 0;
+    
+    // Hand the slot to main, and keep track of the deepest the ring got
+    rx_head++;
+    uint8_t used = rx_head - rx_tail;
+    STAT_MAX(rxHighWater, used);
+    
+    // Restore state
+    mrf_state = MRF_IDLE;
+    LED_PORTx &= ~(1 << LED_RX);
+    
+    // Anything queued while we were receiving can go now
+    tx_start();
+}
+
+// A coded byte.  The only decision here is the one made from the header.
+static void rx_byte(uint8_t bl)
+{
+    if (rx_ecc) {
+        uint8_t code = hamming_decode_nibble_status(bl);
         
-        // Get the location into the payload field
-        uint8_t index = (packetCounter - MRF_PACKET_OVERHEAD) >> 1;
+        if (code & HAMMING_CORRECTED) {
+            receiving_packet->fecCorrected++;
+        }
         
-        // If the packet counter is odd, we're recieving the high nibble
-        // The packet is cleared out beforehand, so we can just or-in the new info
-        if ((packetCounter - MRF_PACKET_OVERHEAD) & 0x01) {
-            receiving_packet->payload[index] |= hamming_decode_nibble(bl) << 4;
+        if (code & HAMMING_ERASED) {
+            receiving_packet->fecErased++;
+            rx_erased = rx_mark;
         }
-        // Otherwise, we're receiving the low nibble
-        else {
-            receiving_packet->payload[index] |= hamming_decode_nibble(bl) & 0x0F;
+        
+        // The low nibble comes first.  Shifting the old contents down and
+        // putting the new nibble on top leaves both nibbles in the right
+        // place after the second one, so the payload doesn't need to be
+        // cleared first.  The pointer only moves after the high nibble.
+        // (The flags are shifted out of the byte.)
+        *rx_ptr = (*rx_ptr >> 4) | (code << 4);
+        
+        if (rx_phase && rx_erased) {
+            *rx_ptr   = MRF_ERASURE_MARK;
+            rx_erased = 0;
         }
+        
+        rx_ptr   += rx_phase;
+        rx_phase ^= 1;
     } else {
-        receiving_packet->payload[packetCounter - MRF_PACKET_OVERHEAD] = bl;
+        *rx_ptr++ = bl;
     }
-
-    packetCounter++;
     
     // End of packet?
-    if (packetCounter >= maxPacketCounter) {
-        // Reset the FIFO
-        RegisterSet(MRF_FIFOSTREG_SET | fiforstregUser);
-        RegisterSet(MRF_FIFOSTREG_SET | fiforstregUser | MRF_FSCF);
-        
-        // Swap packet structures
-        finished_packet = receiving_packet;
-        hasPacket = 1;
-        if (receiving_packet == &Rx_Packet_a) {
-            receiving_packet =  &Rx_Packet_b;
-        } else {
-            receiving_packet =  &Rx_Packet_a;
+    if (--rx_remaining == 0) {
+        rx_finish();
+    }
+}
+
+// Put the bits of an interleaved byte back where they came from, the first
+// bit on the air (the high one) is bit 0 of the block's first coded byte.
+// Once the block is complete, the coded bytes are handled as usual.  That
+// makes the last byte of a block cost depth bytes' worth of work.
+static inline void rx_deinterleave(uint8_t bl)
+{
+    uint8_t mask;
+    
+    if (rx_il_count == 0) {
+        memset(rx_il_block, 0, il_depth);
+        rx_il_byte = 0;
+        rx_il_bit  = 0x01;
+    }
+    
+    for (mask = 0x80; mask; mask >>= 1) {
+        if (bl & mask) {
+            rx_il_block[rx_il_byte] |= rx_il_bit;
         }
         
-        // Restore state
-        mrf_state = MRF_IDLE;
-        LED_PORTx &= ~(1 << LED_RX);
-        packetCounter = 0;
-        receiving_packet->payloadSize = 0;
+        if (++rx_il_byte == il_depth) {
+            rx_il_byte = 0;
+            rx_il_bit <<= 1;
+        }
+    }
+    
+    if (++rx_il_count < il_depth) {
+        return;
+    }
+    
+    rx_il_count = 0;
+    for (mask = 0; mask < il_depth; mask++) {
+        rx_byte(rx_il_block[mask]);
+    }
+    
+    // The rest of the frame isn't a whole block
+    if (rx_remaining < il_depth) {
+        rx_il = 0;
     }
 }
 
+// Payload bytes
+static inline void rx_ISR(void)
+{
+	uint8_t bl = MRF_fifo_read();
+    
+    if (rx_whiten) {
+        bl ^= pn9_next(&rx_pn9);
+    }
+    
+    if (rx_il) {
+        rx_deinterleave(bl);
+    } else {
+        rx_byte(bl);
+    }
+}
+
+// The IRO line is edge triggered, and the FIFO can have more than one byte
+// ready by the time we get here (e.g. if the USB timer ISR held us off).  So
+// keep servicing bytes as long as the FIFO flag is still up, which also
+// saves the interrupt entry and exit for each extra byte.  The loop is
+// bounded by MRF_ISR_MAX_BYTES; the 16 bit FIFO can't get further ahead
+// of us than that.
 ISR(MRF_IRO_VECTOR, ISR_BLOCK)
 {
-	// Set the MRF's CS pin low
-	MRF_CS_PORTx &= ~(1 << MRF_CS_BIT);
+    uint8_t serviced = 0;
+    
+    do {
+        // Set the MRF's CS pin low
+        MRF_CS_PORTx &= ~(1 << MRF_CS_BIT);
 
-	// This needs to be here to delay for the synchronizer
-	mrf_alive = 1;
+        // This needs to be here to delay for the synchronizer
+        mrf_alive = 1;
 	
-	// the MISO pin marks whether the FIFO needs attention
-	if (bit_is_set(SPI_MISO_PINx, SPI_MISO_BIT)) {
+        // the MISO pin marks whether the FIFO needs attention
+        if (bit_is_clear(SPI_MISO_PINx, SPI_MISO_BIT)) {
+            break;
+        }
+        
+        // Time each byte, timer 1 runs at F_CPU
+        uint8_t  state = mrf_state;
+#ifndef MRF_NO_STATS
+        uint16_t start = TCNT1;
+#endif
 		
-		switch (mrf_state) {
+		switch (state) {
 			case MRF_IDLE:              // Passively receiving
                 idle_ISR();
                 break;
@@ -277,7 +870,11 @@ ISR(MRF_IRO_VECTOR, ISR_BLOCK)
                 xmit_ISR();
                 break;
 								
-			case MRF_RECEIVE_PACKET:	// We've received at least the size
+			case MRF_RECEIVE_HEADER:	// We've received the size
+				rx_header_ISR();
+				break;
+
+			case MRF_RECEIVE_PACKET:	// We've received the size and type
 				rx_ISR();
 				break;
 
@@ -296,13 +893,23 @@ ISR(MRF_IRO_VECTOR, ISR_BLOCK)
 			default:
 				break;
 		}
-	}
+        
+#ifndef MRF_NO_STATS
+        // Keep the worst case for each of the packet states
+        uint16_t cycles = TCNT1 - start;
+        if (state < MRF_ISR_STATES) {
+            STAT_MAX(isrCycles[state], cycles);
+        }
+#endif
+        
+        serviced++;
+    } while (serviced < MRF_ISR_MAX_BYTES);
 
-	// There was no FIFO flag, just leave.
-	else {
-		MRF_CS_PORTx |=  (1 << MRF_CS_BIT);
-		return;
-	}	
+	// Leave the CS pin inactive, whichever way we got here
+	MRF_CS_PORTx |=  (1 << MRF_CS_BIT);
+    
+    // Histogram of the number of bytes handled per interrupt
+    STAT_COUNT(isrBytes[serviced]);
 }
 
 void MRF_init()
@@ -324,30 +931,41 @@ void MRF_init()
 	
 	// Enable the External interrupt for the IRO pin (falling edge)
     MRF_INT_SETUP();
+    
+    // Timer 1 runs freely at F_CPU, it's used to time the ISR
+    TCCR1A = 0x00;
+    TCCR1B = (1 << CS10);
 	
 	// configuring the MRF49XA radio
-	RegisterSet(MRF_FIFOSTREG_SET);             // Set 8 bit FIFO interrupt count
-	RegisterSet(MRF_FIFOSTREG_SET | MRF_FSCF);	// Enable sync. latch
-	RegisterSet(MRF_GENCREG_SET);               // From the header: 434mhz, 10pF
-    RegisterSet(MRF_PMCREG | MRF_CLKODIS);      // Shutdown everything
+	RegisterUpdate(MRF_FIFOSTREG_SET);             // Set 8 bit FIFO interrupt count
+	RegisterUpdate(MRF_FIFOSTREG_SET | MRF_FSCF);  // Enable sync. latch
+	RegisterUpdate(MRF_GENCREG_SET);               // From the header: 434mhz, 10pF
+    RegisterUpdate(MRF_PMCREG | MRF_CLKODIS);      // Shutdown everything
 
-    RegisterSet(MRF_TXCREG  | MRF_MODBW_30K | MRF_OTXPWR_0);
-    RegisterSet(MRF_RXCREG  | MRF_FINTDIO   | MRF_RXBW_67K | MRF_DRSSIT_103db);
-    RegisterSet(MRF_BBFCREG | MRF_ACRLC | (4 & MRF_DQTI_MASK));
+    RegisterUpdate(MRF_TXCREG  | MRF_MODBW_30K | MRF_OTXPWR_0);
+    RegisterUpdate(MRF_RXCREG  | MRF_FINTDIO   | MRF_RXBW_67K | MRF_DRSSIT_103db);
+    RegisterUpdate(MRF_BBFCREG | MRF_ACRLC | (4 & MRF_DQTI_MASK));
 
     // antenna tuning on startup
-    RegisterSet(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN); // turn on the transmitter
+    RegisterUpdate(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN); // turn on the transmitter
     _delay_ms(5);                            // wait for oscillator to stablize
 	// end of antenna tuning
 	
 	// turn off transmitter, turn on receiver
-    RegisterSet(MRF_PMCREG | MRF_CLKODIS | MRF_RXCEN);
-    RegisterSet(MRF_GENCREG_SET | MRF_FIFOEN);
-	RegisterSet(MRF_FIFOSTREG_SET);
-	RegisterSet(MRF_FIFOSTREG_SET | MRF_FSCF);
+    RegisterUpdate(MRF_PMCREG | MRF_CLKODIS | MRF_RXCEN);
+    RegisterUpdate(MRF_GENCREG_SET | MRF_FIFOEN);
+	RegisterUpdate(MRF_FIFOSTREG_SET);
+	RegisterUpdate(MRF_FIFOSTREG_SET | MRF_FSCF);
 	
 	// Setup the packet pointers
-	receiving_packet = &Rx_Packet_a;
+	receiving_packet = &Rx_ring[0];
+    
+#ifndef MRF_NO_RS
+    rs_init();
+#endif
+    
+    // The receiver is running, so there's noise to seed from
+    backoff_seed();
 	
 	// Dummy read of status registers to clear Power on reset flag
 	mrf_status = MRF_statusRead();
@@ -368,7 +986,40 @@ void MRF_set_freq(uint16_t freqb)
         return;
     }
     
-    RegisterSet(MRF_CFSREG | freqb);
+    uint8_t sreg = mrf_lock();
+    RegisterUpdate(MRF_CFSREG | freqb);
+    mrf_unlock(sreg);
+}
+
+// Change the bit rate, and the receive bandwidth and deviation to go with
+// it, keeping the rest of RXCREG and TXCREG.  This is only done between
+// frames, so it returns 0 if the radio is busy (try again later).
+uint8_t MRF_set_rate(uint16_t drsreg, uint8_t rxbw, uint8_t modbw)
+{
+    uint8_t sreg = mrf_lock();
+    
+    if (mrf_state != MRF_IDLE) {
+        mrf_unlock(sreg);
+        return 0;
+    }
+    
+    RegisterUpdate(drsreg);
+    RegisterUpdate((mrf_shadow[SHADOW_RXCREG] & ~MRF_RXBW_MASK) | rxbw);
+    RegisterUpdate((mrf_shadow[SHADOW_TXCREG] & ~MRF_MODBW_MASK) | modbw);
+    rx_byte_time = RX_BYTE_TIME(drsreg);
+    
+    mrf_unlock(sreg);
+    return 1;
+}
+
+// The settings MRF_set_rate() takes, as they were last written
+void MRF_get_rate(uint16_t *drsreg, uint8_t *rxbw, uint8_t *modbw)
+{
+    uint8_t sreg = mrf_lock();
+    *drsreg = mrf_shadow[SHADOW_DRSREG];
+    *rxbw   = mrf_shadow[SHADOW_RXCREG] & MRF_RXBW_MASK;
+    *modbw  = mrf_shadow[SHADOW_TXCREG] & MRF_MODBW_MASK;
+    mrf_unlock(sreg);
 }
 
 // Testing functions
@@ -380,17 +1031,19 @@ void MRF_transmit_zero()
 		return;
 	}
 	
+    uint8_t sreg = mrf_lock();
 	mrf_state = MRF_TRANSMIT_ZERO;
     LED_PORTx |= (1 << LED_TX);
     
 	// Enable the TX Register
-	RegisterSet(MRF_GENCREG_SET | MRF_TXDEN);
+	RegisterUpdate(MRF_GENCREG_SET | MRF_TXDEN);
 	
 	// The transmit register is filled with 0xAAAA, we want it to be zeros
 	RegisterSet(MRF_TXBREG | 0x0000);
 	
 	// Enable the transmitter
-	RegisterSet(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+	RegisterUpdate(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+    mrf_unlock(sreg);
 	
 	// Upon completion of a byte !IRO should toggle
 	return;	
@@ -404,17 +1057,19 @@ void MRF_transmit_one()
 		return;
 	}
 	
+    uint8_t sreg = mrf_lock();
 	mrf_state = MRF_TRANSMIT_ONE;
     LED_PORTx |= (1 << LED_TX);
 	
 	// Enable the TX Register
-	RegisterSet(MRF_GENCREG_SET | MRF_TXDEN);
+	RegisterUpdate(MRF_GENCREG_SET | MRF_TXDEN);
 	
 	// The transmit register is filled with 0xAAAA, we want it to be ones
 	RegisterSet(MRF_TXBREG | 0x00FF);
 	
 	// Enable the transmitter
-	RegisterSet(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+	RegisterUpdate(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+    mrf_unlock(sreg);
 	
 	// Upon completion of a byte !IRO should toggle
 	return;	
@@ -428,29 +1083,287 @@ void MRF_transmit_alternating()
 		return;
 	}
 	
+    uint8_t sreg = mrf_lock();
 	mrf_state = MRF_TRANSMIT_ALT;
     LED_PORTx |= (1 << LED_RX);
 
 	// Enable the TX Register
-	RegisterSet(MRF_GENCREG_SET | MRF_TXDEN);
+	RegisterUpdate(MRF_GENCREG_SET | MRF_TXDEN);
 	
 	// The transmit register is filled with 0xAAAA, we can leave it alone
 	
 	// Enable the transmitter
-	RegisterSet(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+	RegisterUpdate(MRF_PMCREG | MRF_CLKODIS | MRF_TXCEN);
+    mrf_unlock(sreg);
 	
 	// Upon completion of a byte !IRO should toggle
 	return;	
 }
 
+void MRF_set_erasure_mark(uint8_t mark)
+{
+    rx_mark = mark;
+}
+
+// Both ends have to use the same depth.  Changing it part way through a
+// frame would lose that frame.
+void MRF_set_interleave(uint8_t depth)
+{
+    if (depth < 2 || depth > MRF_INTERLEAVE_MAX) {
+        depth = MRF_INTERLEAVE_DEFAULT;
+    }
+    
+    uint8_t sreg = mrf_lock();
+    il_depth = depth;
+    rx_il    = 0;
+    mrf_unlock(sreg);
+}
+
+// Like the interleaver depth, both ends have to agree.  A frame being
+// received when it changes is given up on.
+void MRF_set_coded_header(uint8_t coded)
+{
+    uint8_t sreg = mrf_lock();
+    
+    hdr_coded = coded ? 1 : 0;
+    if (mrf_state == MRF_RECEIVE_HEADER || mrf_state == MRF_RECEIVE_PACKET) {
+        rx_abort();
+    }
+    
+    mrf_unlock(sreg);
+}
+
+// Frames are whitened if the app or tx flags ask for it, or if their type
+// is set here.  The receiver goes by the type byte, so this is one-sided.
+void MRF_set_whiten_types(uint8_t types)
+{
+    tx_whiten_types = types;
+}
+
+void MRF_set_csma(uint8_t csma)
+{
+    uint8_t sreg = mrf_lock();
+    tx_csma       = csma;
+    tx_csma_tries = 0;
+    tx_backoff    = 0;
+    mrf_unlock(sreg);
+}
+
+void MRF_set_tx_flags(uint8_t flags)
+{
+    tx_flags = flags & PACKET_FLAGS_SUPPORTED;
+    tx_fec   = flags & PACKET_FEC_MASK;
+}
+
+// The frame check covers the size, type (as sent) and payload
+static uint16_t frame_crc(MRF_packet_t *packet, uint8_t type)
+{
+    uint16_t crc = _crc_xmodem_update(0, packet->payloadSize);
+    crc = _crc_xmodem_update(crc, type);
+    
+    for (uint8_t i = 0; i < packet->payloadSize; i++) {
+        crc = _crc_xmodem_update(crc, packet->payload[i]);
+    }
+    
+    return crc;
+}
+
+// Decode the Golay codewords in place, two at a time (3 bytes of data).
+// The data is never ahead of the codewords it came from.
+static int8_t golay_frame_decode(uint8_t *data, uint8_t size)
+{
+    uint8_t *in  = data;
+    uint8_t  count = GOLAY_CODED_LEN(size) / 3;
+    uint8_t  corrected = 0;
+    uint16_t chunk[2];
+    uint8_t  i, j;
+    
+    for (i = 0; i < count; i += 2) {
+        for (j = 0; j < 2; j++) {
+            uint32_t codeword;
+            int8_t   bits;
+            
+            chunk[j] = 0;
+            if (i + j == count) {
+                break;
+            }
+            
+            codeword = ((uint32_t)in[0] << 16) | ((uint16_t)in[1] << 8) | in[2];
+            in += 3;
+            
+            bits = golay_decode(&codeword);
+            if (bits < 0) {
+                return -1;
+            }
+            
+            corrected += bits;
+            chunk[j] = codeword >> 12;
+        }
+        
+        data[0] = chunk[0] >> 4;
+        data[1] = (chunk[0] << 4) | (chunk[1] >> 8);
+        data[2] = chunk[1] & 0xFF;
+        data += 3;
+    }
+    
+    return corrected;
+}
+
+// Correct a Reed-Solomon or Golay frame.  For Reed-Solomon, the codeword
+// starts at the size byte, and everything after it was received in order.
+// If the size or the coding were wrong the frame was cut up in the wrong
+// places, so it's no good even if the decoder thinks it's fixed it.
+static uint8_t frame_correct(MRF_packet_t *packet)
+{
+    uint8_t size = packet->payloadSize;
+    uint8_t type = packet->type;
+    uint8_t length = MRF_PACKET_OVERHEAD + size + RS_NROOTS;
+    
+    if (PACKET_IS_GOLAY(type)) {
+        if (type & PACKET_FLAG_CRC) {
+            size += MRF_FCS_LEN;
+        }
+        
+        int8_t corrected = golay_frame_decode(packet->payload, size);
+        if (corrected < 0) {
+            STAT_COUNT(rxFecFailed);    // Only main writes this one
+            return 0;
+        }
+        
+        packet->fecCorrected = corrected;
+        return 1;
+    }
+    
+#ifdef MRF_NO_RS
+    // Reed-Solomon frames never get this far
+    (void)length;
+    return 1;
+#else
+    if (!PACKET_IS_RS(type)) {
+        return 1;
+    }
+    
+    if (type & PACKET_FLAG_CRC) {
+        length += MRF_FCS_LEN;
+    }
+    
+    int8_t corrected = rs_decode(&packet->payloadSize, length);
+    if (corrected < 0 || packet->payloadSize != size ||
+        ((packet->type ^ type) & (PACKET_FEC_MASK | PACKET_FLAG_CRC))) {
+        STAT_COUNT(rxFecFailed);    // Only main writes this one
+        return 0;
+    }
+    
+    packet->fecCorrected = corrected;
+    return 1;
+#endif
+}
+
+// Check the frame, if it has a frame check
+static uint8_t frame_ok(MRF_packet_t *packet)
+{
+    if (!(packet->type & PACKET_FLAG_CRC)) {
+        return 1;
+    }
+    
+    uint8_t *fcs = &packet->payload[packet->payloadSize];
+    uint16_t crc = frame_crc(packet, packet->type);
+    return fcs[0] == (crc >> 8) && fcs[1] == (crc & 0xFF);
+}
+
+// Frames that fail their check are dropped here, so the application
+// (and the USB link) never sees them.
 MRF_packet_t* MRF_receive_packet()
 {
-	if (hasPacket) {
-		hasPacket = 0;
-		return finished_packet;
-	} else {
-		return 0;
+    // The packet returned last time is no longer in use, release its slot
+    if (rx_held) {
+        rx_tail++;
+        rx_held = 0;
+    }
+    
+	while (rx_head != rx_tail) {
+        MRF_packet_t *packet = &Rx_ring[rx_tail & MRF_RX_RING_MASK];
+        
+        if (!frame_correct(packet)) {
+            rx_tail++;
+            continue;
+        }
+        
+        // Only main writes these
+        STAT_ADD(rxFecCorrected, packet->fecCorrected);
+        STAT_ADD(rxFecErased, packet->fecErased);
+        
+        if (frame_ok(packet)) {
+            rx_held = 1;
+            return packet;
+        }
+        
+        STAT_COUNT(rxCrcError);     // Only main writes this one
+        rx_tail++;
 	}
+    
+    return 0;
+}
+
+// Called from the timer 0 overflow ISR (every 8.192 mS) to enforce the
+// receive deadline.  If the frame on the air has run out of time, drop it.
+// The slot is simply reused for the next frame.  This also restarts the
+// transmitter after a burst was cut off at MRF_TX_BURST_MAX frames, and
+// counts down the CSMA backoff and the transmit window.
+void MRF_tick(void)
+{
+    uint8_t sreg = mrf_lock();
+    
+    if (rx_ticks && --rx_ticks == 0 &&
+        (mrf_state == MRF_RECEIVE_HEADER || mrf_state == MRF_RECEIVE_PACKET)) {
+        fifo_resync();
+        STAT_COUNT(rxTimeout);
+        
+        mrf_state = MRF_IDLE;
+        LED_PORTx &= ~(1 << LED_RX);
+    }
+    
+    // Anything left waiting can go now (or once it's done backing off)
+    if (tx_backoff) {
+        tx_backoff--;
+    }
+    
+    if (tx_window != MRF_TX_WINDOW_OPEN && tx_window) {
+        tx_window--;
+    }
+    
+    tx_start();
+    
+    mrf_unlock(sreg);
+}
+
+// Measure the number of CPU cycles needed for one register write, using
+// timer 1.  This is used to compare the hardware and software SPI builds.
+uint16_t MRF_spi_cycles(void)
+{
+    uint16_t cycles;
+    
+    uint8_t sreg = mrf_lock();
+    uint16_t start = TCNT1;         // Counting at F_CPU
+    for (uint8_t i = 0; i < 8; i++) {
+        RegisterSet(MRF_STSREG);    // The status read is harmless
+    }
+    cycles = TCNT1 - start;
+    mrf_unlock(sreg);
+    
+    return cycles >> 3;
+}
+
+// Copy the statistics out from under the ISR
+void MRF_get_stats(MRF_stats_t *stats)
+{
+#ifndef MRF_NO_STATS
+    cli();
+    *stats = mrf_stats;
+    sei();
+#else
+    memset(stats, 0, sizeof(MRF_stats_t));
+#endif
 }
 
 uint8_t MRF_is_idle(void)
@@ -479,10 +1392,159 @@ uint8_t MRF_is_alive(void)
 	}
 }
 
-void MRF_transmit_packet(MRF_packet_t *packet)
+// Store a byte in the transmit buffer, returns the next index
+static inline uint8_t tx_put(uint8_t in, uint8_t byte)
+{
+    tx_buf[in] = byte;
+    if (++in == MRF_TX_BUFFER_LEN) {
+        in = 0;
+    }
+    
+    return in;
+}
+
+// Store a byte as it goes on the air, whitened if the frame is
+static uint8_t tx_air(uint8_t in, uint8_t byte)
+{
+    if (tx_whiten) {
+        byte ^= pn9_next(&tx_pn9);
+    }
+    
+    return tx_put(in, byte);
+}
+
+// Store a coded byte (everything after the type byte goes through here).
+// In an interleaved frame the whole blocks are collected and sent with
+// their bits spread out, see MRF_INTERLEAVE_MAX.  The block waits in the
+// space it will be sent from, and is spread out (and whitened) in place.
+static uint8_t tx_code(uint8_t in, uint8_t byte)
+{
+    uint8_t out[MRF_INTERLEAVE_MAX];
+    uint8_t i, j, k, mask, at;
+    
+    if (tx_il_blocks == 0) {
+        return tx_air(in, byte);
+    }
+    
+    if (tx_il_count++ == 0) {
+        tx_il_start = in;
+    }
+    
+    in = tx_put(in, byte);
+    if (tx_il_count < il_depth) {
+        return in;
+    }
+    
+    memset(out, 0, il_depth);
+    k = 0;
+    mask = 0x80;
+    for (i = 0; i < 8; i++) {
+        at = tx_il_start;
+        for (j = 0; j < il_depth; j++) {
+            if (tx_buf[at] & (1 << i)) {
+                out[k] |= mask;
+            }
+            
+            if (++at == MRF_TX_BUFFER_LEN) {
+                at = 0;
+            }
+            
+            mask >>= 1;
+            if (mask == 0) {
+                mask = 0x80;
+                k++;
+            }
+        }
+    }
+    
+    in = tx_il_start;
+    for (i = 0; i < il_depth; i++) {
+        in = tx_air(in, out[i]);
+    }
+    
+    tx_il_count = 0;
+    tx_il_blocks--;
+    
+    return in;
+}
+
+// Store the Golay codewords for 1 to 3 bytes, 1 codeword for 1 byte and 2
+// for more.  The missing bits are zeros.
+static uint8_t tx_put_golay(uint8_t in, uint8_t *chunk, uint8_t count)
+{
+    uint16_t data[2];
+    uint8_t  i;
+    
+    data[0] = ((uint16_t)chunk[0] << 4) | ((count > 1) ? (chunk[1] >> 4) : 0);
+    data[1] = (count > 1) ? (((uint16_t)(chunk[1] & 0x0F) << 8) | ((count > 2) ? chunk[2] : 0)) : 0;
+    
+    for (i = 0; i < ((count > 1) ? 2 : 1); i++) {
+        uint32_t codeword = golay_encode(data[i]);
+        in = tx_code(in, codeword >> 16);
+        in = tx_code(in, codeword >> 8);
+        in = tx_code(in, codeword);
+    }
+    
+    return in;
+}
+
+// Give back the space of frames at the old end of the buffer that are done
+static void tx_reclaim(void)
+{
+    uint8_t sreg = mrf_lock();
+    while (tx_tail != tx_head && tx_frame_flags[tx_tail & MRF_TX_FRAMES_MASK] == 0) {
+        tx_tail++;
+    }
+    mrf_unlock(sreg);
+}
+
+// Queue a packet for transmission, this never waits for the radio.
+// The packet is encoded into its on-air form here, in main context.
+// Returns the frame's entry, or -1 if there isn't room for it.
+static int8_t tx_queue(MRF_packet_t *packet, uint8_t flags)
 {
 	uint8_t	i;
-	uint8_t wait = 1;
+    uint8_t type = packet->type | tx_flags;
+    uint8_t fcs[MRF_FCS_LEN];
+#ifndef MRF_NO_RS
+    uint8_t parity[RS_NROOTS];
+#endif
+    uint8_t size = packet->payloadSize;
+    
+    // Frames that don't pick their own coding get the configured one
+    if ((type & PACKET_FEC_MASK) == PACKET_FEC_DEFAULT) {
+        type |= tx_fec;
+    }
+    
+#ifdef MRF_NO_RS
+    // Left out of the build, see MRF_RS_LEN
+    if (PACKET_IS_RS(type)) {
+        type &= ~PACKET_FEC_MASK;
+    }
+#endif
+    
+    if (tx_whiten_types & (1 << (type & PACKET_TYPE_MASK))) {
+        type |= PACKET_FLAG_WHITEN;
+    }
+    
+    // Golay frames that wouldn't fit in a receive slot get hamming instead
+    if (PACKET_IS_GOLAY(type) &&
+        size + ((type & PACKET_FLAG_CRC) ? MRF_FCS_LEN : 0) > MRF_GOLAY_MAX) {
+        type ^= PACKET_FEC_GOLAY ^ PACKET_FEC_HAMMING;
+    }
+    
+    // Reed-Solomon is better off without the interleaver, see
+    // MRF_INTERLEAVE_MAX
+    if (PACKET_IS_RS(type)) {
+        type &= ~PACKET_FLAG_INTERLEAVE;
+    }
+    
+    uint8_t ecc   = PACKET_IS_HAMMING(type);
+#ifndef MRF_NO_RS
+    uint8_t rs    = PACKET_IS_RS(type);
+#endif
+    uint8_t golay = PACKET_IS_GOLAY(type);
+    uint8_t chunk[3];
 
 	// We can check, without synchronization
 	// (because it doesn't change in the ISR)
@@ -492,36 +1554,176 @@ void MRF_transmit_packet(MRF_packet_t *packet)
         MRF_reset();
 	}
 	
-	// Wait for the module to be idle (this is cheezy synchronization)
-	do {
-		cli();	// Disable interrupts, this is a critical section
-		if (mrf_state == MRF_IDLE) {
-			mrf_state = MRF_TRANSMIT_PACKET;
-			wait = 0;
-			sei();			// Atomic operation complete, reenable interrupts
-		} else {
-			sei();			// Atomic operation complete, reenable interrupts
-			_delay_ms(1);	// This should be roughly 1 byte period
-		}
-	} while (wait);
+    // The frame check is sent after the payload, as if it were part of it
+    if (type & PACKET_FLAG_CRC) {
+        uint16_t crc = frame_crc(packet, type);
+        fcs[0] = crc >> 8;
+        fcs[1] = crc & 0xFF;
+        size += MRF_FCS_LEN;
+    }
+    
+    // ECC payloads are twice as large as advertised
+    uint8_t frameLength = size + MRF_TX_PACKET_OVERHEAD;
+    if (ecc) {
+        frameLength += size;
+    }
+    
+    if (golay) {
+        frameLength += GOLAY_CODED_LEN(size) - size;
+    }
+    
+#ifndef MRF_NO_RS
+    if (rs) {
+        frameLength += RS_NROOTS;
+        memset(parity, 0, RS_NROOTS);
+        rs_encode(parity, packet->payloadSize);
+        rs_encode(parity, type);
+    }
+#endif
+    
+    // The size and type are sent as hamming coded nibbles
+    uint8_t header = hdr_coded ? MRF_HEADER_CODED_EXTRA : 0;
+    frameLength += header;
+    
+    // Is there a free entry, and room for the frame and its length byte?
+    // One byte is always left empty so that a full buffer doesn't look empty.
+    tx_reclaim();
+    if ((uint8_t)(tx_head - tx_tail) >= MRF_TX_FRAMES) {
+        return -1;
+    }
+    
+    uint8_t in   = tx_in;
+    uint8_t out  = (tx_head == tx_tail) ? in : tx_frame_start[tx_tail & MRF_TX_FRAMES_MASK];
+    uint8_t used = (in >= out) ? (in - out) : (MRF_TX_BUFFER_LEN - out + in);
+    if (frameLength + 1 > MRF_TX_BUFFER_LEN - 1 - used) {
+        return -1;
+    }
+    
+    uint8_t frame = tx_head & MRF_TX_FRAMES_MASK;
+    tx_frame_start[frame] = in;
+    
+    tx_il_count  = 0;
+    tx_il_blocks = (type & PACKET_FLAG_INTERLEAVE) ?
+                   (frameLength - MRF_TX_PACKET_OVERHEAD - header) / il_depth : 0;
+    tx_whiten = type & PACKET_FLAG_WHITEN;
+    tx_pn9    = MRF_WHITEN_SEED;
+    
+    in = tx_put(in, frameLength);
+    in = tx_put(in, 0xAA);                  // Preamble, alternating tone
+    in = tx_put(in, 0x2D);                  // Two synchronization bytes
+    in = tx_put(in, 0xD4);
+    if (header) {
+        in = tx_put(in, hamming_encode_nibble(packet->payloadSize & 0x0F));
+        in = tx_put(in, hamming_encode_nibble(packet->payloadSize >> 4));
+        in = tx_put(in, hamming_encode_nibble(type & 0x0F));
+        in = tx_put(in, hamming_encode_nibble(type >> 4));
+    } else {
+        in = tx_put(in, packet->payloadSize);   // Size byte
+        in = tx_put(in, type);                  // Type byte
+    }
+    
+    // In the ECC modes, each nibble is sent as a hamming coded byte,
+    // the low nibble first.
+    for (i = 0; i < size; i++) {
+        uint8_t byte = (i < packet->payloadSize) ?
+                       packet->payload[i] : fcs[i - packet->payloadSize];
+        
+        if (ecc) {
+            in = tx_code(in, hamming_encode_nibble(byte & 0x0F));
+            in = tx_code(in, hamming_encode_nibble(byte >> 4));
+        } else if (golay) {
+            // Every 3 bytes (or the last 1 or 2) go as Golay codewords
+            chunk[i % 3] = byte;
+            if (i % 3 == 2 || i == size - 1) {
+                in = tx_put_golay(in, chunk, i % 3 + 1);
+            }
+        } else {
+            in = tx_code(in, byte);
+        }
+        
+#ifndef MRF_NO_RS
+        if (rs) {
+            rs_encode(parity, byte);
+        }
+#endif
+    }
+    
+#ifndef MRF_NO_RS
+    for (i = 0; rs && i < RS_NROOTS; i++) {
+        in = tx_code(in, parity[i]);
+    }
+#endif
+    
+    // The last byte has to be pushed out of the transmit register
+    in = tx_put(in, 0xAA);
+    
+    // Publish it to the ISR, and kick off the transmitter if it's idle
+    uint8_t sreg = mrf_lock();
+    tx_in = in;
+    tx_frame_flags[frame] = TX_FRAME_SEND | flags;
+    tx_head++;
+    tx_start();
+    mrf_unlock(sreg);
+    
+    return frame;
+}
 
-    LED_PORTx |= (1 << LED_TX);
+// Returns 1 if the packet was queued, or 0 if there isn't room for it.
+uint8_t MRF_transmit_packet(MRF_packet_t *packet)
+{
+    return tx_queue(packet, 0) >= 0;
+}
+
+// Queue a packet, and keep it after it's sent so that it can be sent again
+// with MRF_frame_resend().  The space isn't reused until the frame is
+// released.  Returns a handle for the frame, or -1 if there isn't room.
+int8_t MRF_transmit_retained(MRF_packet_t *packet)
+{
+    return tx_queue(packet, TX_FRAME_KEEP);
+}
 
-	// Initialize the constant parts of the transmit buffer
-	packetCounter = 0;
+// Queue a packet to go before anything else waiting (a TDMA beacon, say).
+// Returns 1 if it was queued, or 0 if there isn't room for it.
+uint8_t MRF_transmit_first(MRF_packet_t *packet)
+{
+    return tx_queue(packet, TX_FRAME_FIRST) >= 0;
+}
 
-    // Copy the packet
-    Tx_packet.payloadSize = packet->payloadSize;
-    Tx_packet.type        = packet->type;
-    uint8_t *packet_bytes = (uint8_t *)packet;
-    for (i = 0; i < packet->payloadSize; i++) {
-        Tx_packet.payload[i] = packet->payload[i];
+// Only start frames in the next ticks ticks, and only those that will be
+// done by then.  MRF_TX_WINDOW_OPEN lifts the limit, 0 holds everything.
+// This can be called from the timer ISR.
+void MRF_tx_window(uint8_t ticks)
+{
+    uint8_t sreg = mrf_lock();
+    tx_window     = ticks;
+    tx_window_len = ticks;
+    tx_start();
+    mrf_unlock(sreg);
+}
+
+// Send a retained frame again (after anything already waiting).  If it's
+// already waiting to go this does nothing.
+void MRF_frame_resend(uint8_t frame)
+{
+    uint8_t sreg = mrf_lock();
+    if (tx_frame_flags[frame] & TX_FRAME_KEEP) {
+        tx_frame_flags[frame] |= TX_FRAME_SEND;
+        tx_start();
     }
+    mrf_unlock(sreg);
+}
 
-	RegisterSet(MRF_PMCREG);					// Turn everything off
-	RegisterSet(MRF_GENCREG_SET | MRF_TXDEN);	// Enable TX FIFO
-	// Reset value of TX FIFO is 0xAAAA
-	
-	RegisterSet(MRF_PMCREG | MRF_TXCEN);		// Begin transmitting
-	// Everything else is handled in the ISR
+// Done with a retained frame, it won't be sent again (if it's waiting to go,
+// it's dropped) and its space can be reused.
+void MRF_frame_release(uint8_t frame)
+{
+    uint8_t sreg = mrf_lock();
+    tx_frame_flags[frame] &= ~(TX_FRAME_KEEP | TX_FRAME_SEND);
+    mrf_unlock(sreg);
+}
+
+// 1 while the frame is waiting to go or on the air
+uint8_t MRF_frame_busy(uint8_t frame)
+{
+    return (tx_frame_flags[frame] & (TX_FRAME_SEND | TX_FRAME_AIR)) != 0;
 }
@@ -8,8 +8,12 @@
  *  Adapted from Microchip MRF49XA sample code (for register states)
  */
 
+#ifndef MRF49XA_H
+#define MRF49XA_H
+
 #include "MRF49XA_definitions.h"
 #include "hardware.h"
+#include "rs8.h"
 
 /*******************************************************************************
  * This section of the header file includes the interface used by the user
@@ -40,19 +44,135 @@ void MRF_registerSet(uint16_t value);
 // included in the payloadSize field in the MRF_PACKET_OVERHEAD define.
 //
 // These defined may be used to access the maximum payload length in the app.
+// The makefile can set a smaller one, for the RAM (both ends of a link
+// have to agree on it).
+#ifndef MRF_PAYLOAD_LEN
 #define MRF_PAYLOAD_LEN        64
+#endif
 
 #define PACKET_TYPE_SERIAL     0x01
 #define PACKET_TYPE_SERIAL_ECC 0x02
 #define PACKET_TYPE_PACKET     0x03
 #define PACKET_TYPE_PACKET_ECC 0x04
+#define PACKET_TYPE_LINK       0x05     // Payload starts with a link header (link.h)
+
+// The packet types only use the low bits of the type byte.  The rest say
+// how the frame was coded: which forward error correction was used, and
+// flags for optional parts of the frame.  A receiver can tell from the
+// type byte alone how a frame was sent (except for the interleaver depth,
+// which has to be set the same at both ends), so frames without any of
+// these are exactly the same as they always were.
+//
+// Bit position:   7  6  5  4  3  2  1  0
+//                 C  W  I  F  F  T  T  T
+//   T  Packet type
+//   F  Forward error correction, 0 means whatever the type implies
+//      (hamming for the _ECC types, nothing for the others)
+//   I  Everything after the type byte is bit interleaved
+//   W  Everything after the type byte is whitened, see MRF_WHITEN_SEED
+//   C  CRC-16 frame check follows the payload
+#define PACKET_TYPE_MASK       0x07
+#define PACKET_FEC_MASK        0x18
+#define PACKET_FEC_DEFAULT     0x00
+#define PACKET_FEC_HAMMING     0x08     // Each nibble is sent as a coded byte
+#define PACKET_FEC_RS          0x10     // RS_NROOTS Reed-Solomon parity bytes follow
+#define PACKET_FEC_GOLAY       0x18     // Each 12 bits is sent as a Golay codeword
+#define PACKET_FLAG_INTERLEAVE 0x20
+#define PACKET_FLAG_WHITEN     0x40
+#define PACKET_FLAG_CRC        0x80
+#define PACKET_FLAGS_SUPPORTED (PACKET_FLAG_CRC | PACKET_FLAG_WHITEN | PACKET_FLAG_INTERLEAVE)
+
+// Whether a frame's payload is hamming coded
+#define PACKET_IS_HAMMING(type)                                               \
+    (((type) & PACKET_FEC_MASK) == PACKET_FEC_HAMMING ||                      \
+     (((type) & PACKET_FEC_MASK) == PACKET_FEC_DEFAULT &&                     \
+      (((type) & PACKET_TYPE_MASK) == PACKET_TYPE_SERIAL_ECC ||               \
+       ((type) & PACKET_TYPE_MASK) == PACKET_TYPE_PACKET_ECC)))
+
+#define PACKET_IS_RS(type)     (((type) & PACKET_FEC_MASK) == PACKET_FEC_RS)
+#define PACKET_IS_GOLAY(type)  (((type) & PACKET_FEC_MASK) == PACKET_FEC_GOLAY)
+
+// The frame check is the XMODEM CRC-16 (polynomial 0x1021, start at 0) of
+// the size, type and payload bytes, sent high byte first.  When the type
+// is an ECC type it's hamming coded like the payload.
+#define MRF_FCS_LEN         2
+
+// Reed-Solomon frames are sent as they are, with the parity after the
+// payload and frame check.  The codeword is the size, type, payload and
+// frame check, so the header is checked as well.  Frames are corrected in
+// MRF_receive_packet(), not the ISR.  At a full payload the parity is an
+// eighth of the frame, where hamming doubles it, and it corrects any
+// RS_NROOTS / 2 bad bytes however many bits are wrong in each.
+//
+// Reed-Solomon can be left out of the build with MRF_NO_RS, for the RAM:
+// the parity room in every receive slot, and the decoder's stack.  Frames
+// set to be sent with it get the default coding for their type instead,
+// and Reed-Solomon frames that arrive are dropped.
+#ifdef MRF_NO_RS
+#define MRF_RS_LEN          0
+#else
+#define MRF_RS_LEN          RS_NROOTS
+#endif
 
 typedef struct {
     uint8_t  payloadSize;   // Total size of the payload
-    uint8_t  type;          // for now, set to 0xBD
+    uint8_t  type;          // PACKET_TYPE_*, and any PACKET_FLAG_*
     uint8_t  payload[MRF_PAYLOAD_LEN];
+    uint8_t  fcs[MRF_FCS_LEN];  // Room for the received frame check, which
+                                // follows the payload, internal use
+#ifndef MRF_NO_RS
+    uint8_t  parity[RS_NROOTS]; // And for Reed-Solomon parity after that
+#endif
+    uint8_t  fecCorrected;  // Nibbles (hamming) or bytes (Reed-Solomon) fixed
+    uint8_t  fecErased;     // Hamming nibbles with two bad bits, not fixed
+    uint8_t  rssi;          // Signal was over the RSSI threshold at the start
 } MRF_packet_t;
 
+// Interleaving spreads each block of depth coded bytes over the same number
+// of bytes on the air, so that bit i of the block goes out as bit i % depth
+// of coded byte i / depth.  A burst of up to depth bad bits then hits each
+// coded byte (or hamming codeword) at most once.  Only whole blocks are
+// interleaved, the bytes left at the end are sent as they are.
+//
+// Reed-Solomon frames are never interleaved.  RS fixes whole bytes, so a
+// burst kept inside one or two bytes costs it one or two of its four
+// correctable bytes, while spread out it spoils up to depth of them.  With
+// 6 bit bursts RS alone decoded 64 frames of 64, interleaved only 7 to 9.
+// The receiver goes by the type byte, so frames sent interleaved by older
+// firmware are still taken apart properly.
+#define MRF_INTERLEAVE_MAX      8
+#define MRF_INTERLEAVE_DEFAULT  8
+
+// Bytes a receive slot has for whatever follows the type byte
+#define MRF_RX_ROOM         (MRF_PAYLOAD_LEN + MRF_FCS_LEN + MRF_RS_LEN)
+
+// Golay frames are the same size as hamming ones, but they're decoded in
+// MRF_receive_packet() rather than the ISR, so the codewords have to fit in
+// a receive slot as they are.  That's enough for MRF_GOLAY_MAX bytes of
+// payload and frame check, bigger frames are sent hamming coded instead.
+#define MRF_GOLAY_MAX       ((MRF_RX_ROOM / 6) * 3)
+
+// Whitening XORs the bytes on the air (after coding and interleaving) with
+// the PN9 sequence (x^9 + x^5 + 1), starting from this seed for each frame.
+// Long runs of zeros or ones in the data become a mix of both, which keeps
+// the clock recovery locked.  The type byte says whether a frame is
+// whitened, and the types that always are can be set with
+// MRF_set_whiten_types().
+#define MRF_WHITEN_SEED         0x01FF
+
+// With the coded header on, the size and type bytes are each sent as two
+// hamming coded nibbles (low nibble first), the same way as an ECC payload.
+// A bad bit in either is corrected before the size is trusted, and with the
+// SECDED tables two bad bits in a nibble drop the frame straight away.  The
+// receiver can't tell a coded header from a plain one, so this has to be
+// set the same at both ends (see MRF_set_coded_header()).
+#define MRF_HEADER_CODED_EXTRA  2
+
+// A byte with an erased nibble is only a guess.  The driver can replace
+// those with this instead (see MRF_set_erasure_mark()), so the app can tell
+// where they were.
+#define MRF_ERASURE_MARK    0x00
+
 // These defines are used internally to the library, they include 
 // Packet overhead (length)
 #define MRF_PACKET_OVERHEAD 2
@@ -61,12 +181,146 @@ typedef struct {
 // Space for preamble, sync (2 bytes), length, type and dummy
 #define MRF_TX_PACKET_OVERHEAD 6
 
+// Number of received packets that can be waiting for the application.
+// This must be a power of two.  One slot is always in use by the app
+// between calls to MRF_receive_packet().  Each slot costs a full
+// MRF_packet_t of RAM, so don't make this any larger than necessary
+// (see RAM_BUDGET in the makefile).  With ARQ a burst of frames can
+// arrive back to back while the app is busy with one, so 2 isn't enough.
+#ifdef LINK_NO_ARQ
+#define MRF_RX_RING_LEN     2
+#else
+#define MRF_RX_RING_LEN     4
+#endif
+#define MRF_RX_RING_MASK    (MRF_RX_RING_LEN - 1)
+
+#if (MRF_RX_RING_LEN & MRF_RX_RING_MASK) || (MRF_RX_RING_LEN < 2)
+#error MRF_RX_RING_LEN must be a power of two, and at least 2
+#endif
+
+// Size of the transmit buffer, which holds frames exactly as they will be
+// sent (plus a length byte each).  It must fit at least one ECC frame of
+// the maximum size, and can't be more than 255.  Frames kept for
+// retransmission stay in here too, so this also limits how much data can
+// be waiting for an acknowledgement.  Without ARQ, room for one ECC frame
+// (or a few short ones) is enough to keep the transmitter busy.
+#define MRF_TX_FRAME_MAX    ((MRF_PAYLOAD_LEN + MRF_FCS_LEN) * 2 + MRF_TX_PACKET_OVERHEAD + \
+                             MRF_HEADER_CODED_EXTRA)
+
+// Most frames that can be in the transmit buffer at once (a power of two)
+#ifdef LINK_NO_ARQ
+#define MRF_TX_BUFFER_LEN   (MRF_TX_FRAME_MAX + 2)
+#define MRF_TX_FRAMES       4
+#else
+#define MRF_TX_BUFFER_LEN   144
+#define MRF_TX_FRAMES       8
+#endif
+#define MRF_TX_FRAMES_MASK  (MRF_TX_FRAMES - 1)
+
+#if (MRF_TX_FRAMES & MRF_TX_FRAMES_MASK)
+#error MRF_TX_FRAMES must be a power of two
+#endif
+
+#if (MRF_TX_BUFFER_LEN < MRF_TX_FRAME_MAX + 2) || (MRF_TX_BUFFER_LEN > 255)
+#error MRF_TX_BUFFER_LEN must fit a full size ECC frame, and less than 256
+#endif
+
+// Most frames sent back to back before the transmitter is turned off, see
+// xmit_ISR().  The rest wait a tick, so the other side gets a chance to
+// send (an ARQ acknowledgement, say).
+#define MRF_TX_BURST_MAX    MRF_TX_FRAMES
+
+// Listen before talk.  With CSMA on, a frame only starts if the status
+// register shows no signal over the RSSI threshold (DRSSIT in RXCREG) and
+// no data (the DQD, DQTI in BBFCREG).  Otherwise it waits a random 1 to
+// 2^n ticks, with n going up from MRF_CSMA_BE_MIN each time the channel is
+// still busy, to MRF_CSMA_BE_MAX.  After MRF_CSMA_TRIES busy checks it's
+// sent anyway, a frame that never goes is worse than a collision.
+#define MRF_CSMA_BE_MIN     1
+#define MRF_CSMA_BE_MAX     5
+#define MRF_CSMA_TRIES      8
+
+// A transmit window without an end, see MRF_tx_window()
+#define MRF_TX_WINDOW_OPEN  0xFF
+
+// Most FIFO bytes that will be serviced in one IRO interrupt
+#define MRF_ISR_MAX_BYTES   4
+
+// The IRO interrupt budget
+//
+// The FIFO flag goes up when 8 bits have arrived (or the TX register is
+// empty), and the 16 bit FIFO gives us one more byte time before data is
+// lost.  So the worst case time from the flag to the byte being serviced
+// must be less than one byte time.  That is made up of:
+//
+//   - The longest main-context critical section (mrf_lock()), at most
+//     three or four register writes.
+//   - Interrupt entry and exit.
+//   - The work for the byte itself.  Each payload byte (idle, header, rx
+//     and tx) is one FIFO or TX register access plus a few stores.  The
+//     last byte of a packet also resyncs the FIFO and may start the next
+//     transmission.  In an interleaved frame, every byte also has its bits
+//     scattered, and the last byte of each block does the work of depth
+//     bytes.  A whitened frame costs a little more per received byte.
+//     The first byte of a received frame also reads the status register
+//     for the RSSI, which is one more register access, and so does
+//     starting a transmission with CSMA on.
+//
+// Register accesses are most of it, and the bit-banged SPI makes each one
+// several times slower.  Menu option 7 times a register write on the
+// board (MRF_spi_cycles()), and the ISR records the worst case it sees
+// for each state in isrCycles (printed with the link statistics).
+//
+// "make isr-bench" measures the whole of it on a simulated board, for
+// every frame coding in both directions (isr-bench/mrf_sim.c).  It fails
+// if the worst case doesn't fit a byte time at the fastest rate in rate.c,
+// and prints the fastest bit rate the driver can keep up with.
+#define MRF_ISR_STATES      4   // idle, transmit, receive, header
+
+// Link statistics maintained by the driver, read them with MRF_get_stats()
+// (all zeros if they were left out with MRF_NO_STATS)
+typedef struct {
+    uint16_t rxOverflow;    // Packets dropped because the receive ring was full
+    uint16_t rxTimeout;     // Packets dropped because they stopped short
+    uint16_t rxCrcError;    // Packets dropped because the CRC didn't match
+    uint16_t rxFecCorrected;    // Nibbles, bytes or bits (Golay) corrected
+    uint16_t rxFecErased;   // Hamming nibbles that couldn't be corrected
+    uint16_t rxFecFailed;   // Packets dropped with too many errors to correct
+    uint16_t rxHeaderError; // Coded headers dropped as uncorrectable or nonsense
+    uint8_t  rxHighWater;   // Largest number of receive slots in use at once
+    uint16_t txComplete;    // Packets that have finished transmitting
+    uint16_t txChained;     // Of those, sent straight after another one
+    uint16_t csmaBusy;      // Times a frame waited for a busy channel
+    uint16_t csmaForced;    // Frames sent after MRF_CSMA_TRIES waits
+    uint16_t spiDeferred;   // IRO interrupts held off by a main SPI transaction
+    uint16_t regWritesSkipped;  // Register writes that didn't change anything
+    uint16_t isrBytes[MRF_ISR_MAX_BYTES + 1];   // IRO interrupts, by bytes serviced
+    uint16_t isrCycles[MRF_ISR_STATES];         // Worst cycles per byte, by state
+} MRF_stats_t;
+
 // Packet based functions
-void MRF_transmit_packet(MRF_packet_t *packet);
-MRF_packet_t* MRF_receive_packet(void);
+uint8_t MRF_transmit_packet(MRF_packet_t *packet);  // 0 if the queue is full
+int8_t  MRF_transmit_retained(MRF_packet_t *packet);    // Handle, -1 if full
+uint8_t MRF_transmit_first(MRF_packet_t *packet);   // Ahead of the queue, 0 if full
+void    MRF_tx_window(uint8_t ticks);   // Only send for this long
+void    MRF_frame_resend(uint8_t frame);
+void    MRF_frame_release(uint8_t frame);
+uint8_t MRF_frame_busy(uint8_t frame);  // Waiting to go, or on the air
+MRF_packet_t* MRF_receive_packet(void);   // Valid until the next call
+void MRF_get_stats(MRF_stats_t *stats);
+uint16_t MRF_spi_cycles(void);  // CPU cycles for one register write
+void MRF_tick(void);            // Call from the 8.192 mS timer, any context
 
 void MRF_set_baud(uint16_t baud);	// Sets the baud rate in kbps
 void MRF_set_freq(uint16_t freqb);  // Setting for the FREQB register
+uint8_t MRF_set_rate(uint16_t drsreg, uint8_t rxbw, uint8_t modbw);    // 0 if busy
+void MRF_get_rate(uint16_t *drsreg, uint8_t *rxbw, uint8_t *modbw);    // As last written
+void MRF_set_tx_flags(uint8_t flags);   // PACKET_FEC_* and PACKET_FLAG_*s for every frame sent
+void MRF_set_erasure_mark(uint8_t mark);    // Replace guessed bytes with MRF_ERASURE_MARK
+void MRF_set_interleave(uint8_t depth);     // 2 to MRF_INTERLEAVE_MAX, 0 for the default
+void MRF_set_coded_header(uint8_t coded);   // Send and expect hamming coded headers
+void MRF_set_whiten_types(uint8_t types);   // Bit n set whitens PACKET_TYPE n frames
+void MRF_set_csma(uint8_t csma);            // Listen before talk
 
 // Testing functions
 void MRF_transmit_zero(void);
@@ -76,3 +330,4 @@ void MRF_packet_reflect(void);
 void MRF_packet_generator(void);
 void MRF_reset(void);
 
+#endif
@@ -0,0 +1,194 @@
+//
+//  adapt.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#include <string.h>
+#include "adapt.h"
+#include "utilities.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(value) *value
+#endif
+
+#ifndef LINK_NO_ADAPT
+
+// The coding for each level, weakest first
+static const uint8_t adapt_fec[ADAPT_LEVELS] PROGMEM = {
+    PACKET_FEC_DEFAULT,
+    PACKET_FEC_RS,
+    PACKET_FEC_HAMMING,
+    PACKET_FEC_GOLAY
+};
+
+static uint8_t  adapt_enabled;
+static uint16_t adapt_changed;  // Tick of the last level change
+
+// Frames lost so far, from the driver's statistics
+static uint16_t adapt_lost;
+static uint16_t adapt_polled;
+
+static ADAPT_stats_t adapt_stats;
+
+void adaptConfigure(uint16_t linkopt2)
+{
+    adapt_enabled = (linkopt2 & LINKOPT2_ADAPT_FEC) != 0;
+}
+
+uint8_t adaptEnabled(void)
+{
+    return adapt_enabled;
+}
+
+void adaptTag(MRF_packet_t *packet)
+{
+    if (!adapt_enabled) {
+        return;
+    }
+
+    packet->type = (packet->type & ~PACKET_FEC_MASK) |
+                   pgm_read_byte(&adapt_fec[adapt_stats.level]);
+    packet->payload[0] |= LINK_QUALITY;
+    packet->payload[packet->payloadSize++] = adapt_stats.score;
+}
+
+// Add a frame to our score
+static void adapt_sample(uint8_t sample)
+{
+    uint8_t score = adapt_stats.score;
+    adapt_stats.score = score - (score >> 3) + (sample >> 3);
+}
+
+// Pick our coding from the other side's score
+static void adapt_report(uint8_t report)
+{
+    uint16_t now   = getTicks();
+    uint8_t  level = adapt_stats.level;
+
+    adapt_stats.peer = report;
+
+    if ((uint16_t)(now - adapt_changed) < ADAPT_HOLD) {
+        return;
+    }
+
+    if (report >= ADAPT_STEP_UP && level < ADAPT_LEVELS - 1) {
+        level++;
+    } else if (report < ADAPT_STEP_DOWN && level > 0) {
+        level--;
+    } else {
+        return;
+    }
+
+    adapt_changed = now;
+    adapt_stats.level = level;
+    adapt_stats.switches++;
+
+    memmove(&adapt_stats.log[0], &adapt_stats.log[1],
+            sizeof(ADAPT_switch_t) * (ADAPT_LOG_LEN - 1));
+    adapt_stats.log[ADAPT_LOG_LEN - 1].tick   = now;
+    adapt_stats.log[ADAPT_LOG_LEN - 1].level  = level;
+    adapt_stats.log[ADAPT_LOG_LEN - 1].report = report;
+}
+
+// Frames the driver dropped count against us too.  Those that time out
+// or have a nonsense header aren't counted, noise does that all the time.
+static void adapt_poll_lost(void)
+{
+    uint16_t now = getTicks();
+    MRF_stats_t stats;
+
+    if (now == adapt_polled) {
+        return;
+    }
+
+    adapt_polled = now;
+    MRF_get_stats(&stats);
+
+    // More than this and the score is as bad as it gets anyway
+    uint16_t lost = stats.rxCrcError + stats.rxFecFailed;
+    uint16_t count = lost - adapt_lost;
+    if (count > 32) {
+        count = 32;
+    }
+
+    adapt_lost = lost;
+    while (count--) {
+        adapt_sample(ADAPT_SAMPLE_LOST);
+    }
+}
+
+MRF_packet_t* adaptReceive(void)
+{
+    MRF_packet_t *packet;
+
+    adapt_poll_lost();
+
+    packet = MRF_receive_packet();
+    if (packet == 0) {
+        return 0;
+    }
+
+    adapt_sample((packet->fecCorrected || packet->fecErased) ? ADAPT_SAMPLE_CORRECTED : 0);
+
+    if ((packet->type & PACKET_TYPE_MASK) == PACKET_TYPE_LINK &&
+        packet->payloadSize > LINK_HEADER_LEN &&
+        (packet->payload[0] & LINK_QUALITY)) {
+        packet->payloadSize -= ADAPT_REPORT_LEN;
+        packet->payload[0]  &= ~LINK_QUALITY;
+        adapt_report(packet->payload[packet->payloadSize]);
+    }
+
+    return packet;
+}
+
+void adaptGetStats(ADAPT_stats_t *stats)
+{
+    *stats = adapt_stats;
+}
+
+#else
+
+// Left out of the build.  Reports from the other side are still taken off
+// the frames, so their data gets through.
+void adaptConfigure(uint16_t linkopt2)
+{
+    (void)linkopt2;
+}
+
+uint8_t adaptEnabled(void)
+{
+    return 0;
+}
+
+void adaptTag(MRF_packet_t *packet)
+{
+    (void)packet;
+}
+
+MRF_packet_t* adaptReceive(void)
+{
+    MRF_packet_t *packet = MRF_receive_packet();
+
+    if (packet != 0 &&
+        (packet->type & PACKET_TYPE_MASK) == PACKET_TYPE_LINK &&
+        packet->payloadSize > LINK_HEADER_LEN &&
+        (packet->payload[0] & LINK_QUALITY)) {
+        packet->payloadSize -= ADAPT_REPORT_LEN;
+        packet->payload[0]  &= ~LINK_QUALITY;
+    }
+
+    return packet;
+}
+
+void adaptGetStats(ADAPT_stats_t *stats)
+{
+    memset(stats, 0, sizeof(ADAPT_stats_t));
+}
+
+#endif
@@ -0,0 +1,74 @@
+//
+//  adapt.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_adapt_h
+#define MRF49XA_Dongle_adapt_h
+
+#include <stdint.h>
+#include "MRF49XA.h"
+#include "link.h"
+
+// Adaptive FEC for the packet modes.
+//
+// Each side keeps a score of how its receiving is going (whether this is
+// on or not, rate.h uses it too): a running average
+// (1/8 weight per frame) where a clean frame counts 0, a frame that needed
+// correcting counts ADAPT_SAMPLE_CORRECTED and a frame lost to a bad CRC or
+// too many errors counts ADAPT_SAMPLE_LOST.  With adaptation on, every link
+// frame sent (ARQ acknowledgements too) ends with LINK_QUALITY set and our
+// score as the last byte.
+//
+// The other side's score decides the coding of the frames we send.  It
+// goes up a level when the score reaches ADAPT_STEP_UP, and down a level
+// when it's under ADAPT_STEP_DOWN, but no more than once per ADAPT_HOLD
+// ticks, so the score has time to show what the new coding does.  The
+// levels are no coding, Reed-Solomon parity (cheap, for the odd bad byte),
+// hamming and Golay (both twice the airtime).  The type byte says how each
+// frame was coded, so the receiver doesn't need to know about any of this.
+//
+// Scores only come back with frames going the other way, so this works
+// best with ARQ, where every data frame is acknowledged.
+#define ADAPT_REPORT_LEN        1
+
+#define ADAPT_SAMPLE_CORRECTED  32
+#define ADAPT_SAMPLE_LOST       255
+#define ADAPT_STEP_UP           48
+#define ADAPT_STEP_DOWN         8
+#define ADAPT_HOLD              122     // Ticks (8.192 mS each), about 1 S
+
+#define ADAPT_LEVELS            4
+#define ADAPT_LOG_LEN           4       // Level changes kept for the menu
+
+typedef struct {
+    uint16_t tick;          // When it changed
+    uint8_t  level;         // What it changed to
+    uint8_t  report;        // The score that changed it
+} ADAPT_switch_t;
+
+typedef struct {
+    uint8_t  level;         // Coding in use now, 0 to ADAPT_LEVELS - 1
+    uint8_t  score;         // How our receiving is going
+    uint8_t  peer;          // How the other side's is, from its last report
+    uint16_t switches;      // Level changes, the last ADAPT_LOG_LEN of them:
+    ADAPT_switch_t log[ADAPT_LOG_LEN];  // oldest first
+} ADAPT_stats_t;
+
+void    adaptConfigure(uint16_t linkopt2);
+uint8_t adaptEnabled(void);
+
+// Set the coding of a link frame, and add our score to the end of it.
+// There must be room for ADAPT_REPORT_LEN more bytes of payload.
+void adaptTag(MRF_packet_t *packet);
+
+// The next received packet, with any score removed (and LINK_QUALITY
+// cleared).  Valid until the next call.
+MRF_packet_t* adaptReceive(void);
+
+void adaptGetStats(ADAPT_stats_t *stats);
+
+#endif
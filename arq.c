@@ -0,0 +1,442 @@
+//
+//  arq.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#include <string.h>
+#include "arq.h"
+#include "adapt.h"
+#include "tdma.h"
+#include "utilities.h"
+
+#ifndef LINK_NO_ARQ
+
+// Settings, from the link options
+static uint8_t  arq_enabled;
+static uint8_t  arq_window = ARQ_WINDOW_DEFAULT;
+static uint16_t arq_timeout = ARQ_TIMEOUT_DEFAULT;
+
+// Sending side.  Frames tx_base up to (not including) tx_next are
+// outstanding, frame s is in entry s % ARQ_WINDOW_MAX.
+#define ARQ_ACKED   0x01    // Acknowledged, its frame has been released
+#define ARQ_NACKED  0x02    // Already sent again because of a gap in a sack
+
+typedef struct {
+    uint8_t  frame;         // Handle from MRF_transmit_retained()
+    uint8_t  flags;
+    uint8_t  retries;
+    uint16_t deadline;      // Tick to send it again at
+} arq_entry_t;
+
+static arq_entry_t arq_sent[ARQ_WINDOW_MAX];
+static uint8_t tx_base;     // Oldest frame not yet acknowledged
+static uint8_t tx_next;     // Sequence number for the next new frame
+
+// Receiving side.  Bit i of rx_bitmap is set if frame rx_next + i has
+// arrived.  Bit 0 is always clear, the window slides past it.
+static uint8_t  rx_next;
+static uint8_t  rx_bitmap;
+static uint8_t  ack_due;    // We owe the other side an acknowledgement
+static uint16_t ack_deadline;
+static uint8_t  rx_skipped; // We've moved past frames, see arqSkipped()
+static uint8_t  rx_newest;  // Newest sequence number seen from the other side
+
+static ARQ_stats_t arq_stats;
+
+void arqConfigure(uint16_t linkopt)
+{
+    uint8_t  window  = ARQ_LINKOPT_WINDOW(linkopt);
+    uint16_t timeout = ARQ_LINKOPT_TIMEOUT(linkopt);
+
+    arq_enabled = (linkopt & LINKOPT_ARQ) != 0;
+    arq_window  = (window == 0 || window > ARQ_WINDOW_MAX) ? ARQ_WINDOW_DEFAULT : window;
+    arq_timeout = (timeout == 0) ? ARQ_TIMEOUT_DEFAULT : timeout;
+}
+
+uint8_t arqEnabled(void)
+{
+    return arq_enabled;
+}
+
+static inline void arq_header(MRF_packet_t *packet, uint8_t seq)
+{
+    packet->payload[0] |= LINK_ARQ;
+    packet->payload[LINK_HEADER_LEN + 0] = seq;
+    packet->payload[LINK_HEADER_LEN + 1] = rx_next;
+    packet->payload[LINK_HEADER_LEN + 2] = rx_bitmap;
+    packet->payload[LINK_HEADER_LEN + 3] = tx_base;
+    packet->type |= PACKET_FLAG_CRC;
+}
+
+uint8_t arqSend(MRF_packet_t *packet)
+{
+    if ((uint8_t)(tx_next - tx_base) >= arq_window) {
+        return 0;
+    }
+
+    arq_header(packet, tx_next);
+
+    int8_t frame = MRF_transmit_retained(packet);
+    if (frame < 0) {
+        return 0;
+    }
+
+    arq_entry_t *entry = &arq_sent[tx_next % ARQ_WINDOW_MAX];
+    entry->frame    = frame;
+    entry->flags    = 0;
+    entry->retries  = 0;
+    entry->deadline = getTicks() + arq_timeout;
+    tx_next++;
+
+    // This carries our acknowledgement
+    ack_due = 0;
+
+    return 1;
+}
+
+static void arq_acked(uint8_t seq)
+{
+    arq_entry_t *entry = &arq_sent[seq % ARQ_WINDOW_MAX];
+
+    if (!(entry->flags & ARQ_ACKED)) {
+        entry->flags |= ARQ_ACKED;
+        MRF_frame_release(entry->frame);
+    }
+}
+
+// Move the window past everything that's been acknowledged
+static void arq_advance(void)
+{
+    while (tx_base != tx_next && (arq_sent[tx_base % ARQ_WINDOW_MAX].flags & ARQ_ACKED)) {
+        tx_base++;
+    }
+}
+
+// Send our header soon, without waiting for data to carry it
+static void arq_header_soon(void)
+{
+    if (!ack_due) {
+        ack_due = 1;
+        ack_deadline = getTicks();
+    }
+}
+
+// An acknowledgement from the other side, for frames we've sent.  A frame
+// that's sent again still has the header from when it was queued, which
+// can be older than what we've heard since.  What's acknowledged in an old
+// header is still true, but its gaps and its ack may well have been filled
+// since, so those are only acted on in a fresh header.
+static void arq_handle_ack(uint8_t ack, uint8_t sack, uint8_t fresh)
+{
+    uint8_t outstanding = tx_next - tx_base;
+    uint8_t seq, i;
+
+    // The other side is still waiting for a frame we've given up on.  Our
+    // header tells it where we are.
+    if (fresh && (uint8_t)(tx_base - ack - 1) < 127) {
+        arq_header_soon();
+    }
+
+    // Everything before ack has arrived.  An ack outside of the window is
+    // old news (or the other side restarted), the retries sort that out.
+    if ((uint8_t)(ack - tx_base) <= outstanding) {
+        for (seq = tx_base; seq != ack; seq++) {
+            arq_acked(seq);
+        }
+    }
+
+    // Frames that arrived out of order, and the gaps below them
+    for (i = 0; i < ARQ_WINDOW_MAX && (sack >> i); i++) {
+        seq = ack + i;
+        if ((uint8_t)(seq - tx_base) >= outstanding) {
+            continue;
+        }
+
+        arq_entry_t *entry = &arq_sent[seq % ARQ_WINDOW_MAX];
+        if (sack & (1 << i)) {
+            arq_acked(seq);
+        } else if (fresh && !(entry->flags & (ARQ_ACKED | ARQ_NACKED)) &&
+                   !MRF_frame_busy(entry->frame)) {
+            entry->flags |= ARQ_NACKED;
+            entry->deadline = getTicks() + arq_timeout;
+            MRF_frame_resend(entry->frame);
+            arq_stats.retransmits++;
+        }
+    }
+
+    arq_advance();
+}
+
+// Slide the receive window forward by n frames
+static void arq_slide(uint8_t n)
+{
+    rx_next  += n;
+    rx_bitmap = (n < 8) ? (rx_bitmap >> n) : 0;
+}
+
+// The other side has stopped sending everything before base.  If we're
+// still waiting for any of that, move up to base.  Headers of frames sent
+// again are stale, and their base is behind us, which is ignored.
+static void arq_catch_up(uint8_t base)
+{
+    uint8_t d = base - rx_next;
+
+    if (d == 0 || d >= 128) {
+        return;
+    }
+
+    arq_slide(d);
+    while (rx_bitmap & 0x01) {
+        arq_slide(1);
+    }
+
+    arq_stats.skipped += d;
+    rx_skipped = 1;
+}
+
+// A data frame from the other side, returns 1 if it's new.  Fragments
+// of long messages have to be passed on in order, and there's no room to
+// hold them back, so those are only taken in order.  The ones we turn away
+// are acknowledged anyway, and come again after the retry timeout.  If the
+// other side has given up on the frame we're waiting for, that
+// acknowledgement gets us its base (see arq_handle_ack()), so the next try
+// is taken.
+static uint8_t arq_accept(uint8_t seq, uint8_t in_order)
+{
+    uint8_t d = seq - rx_next;
+    uint8_t top = in_order ? 0 : (ARQ_WINDOW_MAX - 1);
+
+    // We've seen it already, our acknowledgement must have been lost
+    if (d >= (uint8_t)(256 - ARQ_WINDOW_MAX)) {
+        arq_stats.duplicates++;
+        return 0;
+    }
+
+    // Too far ahead of us to be in the other side's window, which means it
+    // gave up on something (or restarted).  Move up to meet it.
+    if (d >= ARQ_WINDOW_MAX) {
+        arq_slide(d - top);
+        d = top;
+    }
+
+    if (d > top) {
+        return 0;
+    }
+
+    if (rx_bitmap & (1 << d)) {
+        arq_stats.duplicates++;
+        return 0;
+    }
+
+    rx_bitmap |= (1 << d);
+    while (rx_bitmap & 0x01) {
+        arq_slide(1);
+    }
+
+    return 1;
+}
+
+MRF_packet_t* arqReceive(void)
+{
+    MRF_packet_t *packet;
+    uint8_t *header;
+    uint8_t  fresh;
+
+    while ((packet = tdmaReceive()) != 0) {
+        if ((packet->type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK ||
+            !(packet->payload[0] & LINK_ARQ)) {
+            return packet;
+        }
+
+        if (packet->payloadSize < LINK_HEADER_LEN + ARQ_HEADER_LEN) {
+            continue;
+        }
+
+        // Sequence numbers only go backwards for a frame sent again, which
+        // has an old header.  Acknowledgement only frames are always fresh,
+        // they carry the next sequence number.
+        header = &packet->payload[LINK_HEADER_LEN];
+        fresh  = (uint8_t)(header[0] - rx_newest) < 128;
+        if (fresh) {
+            rx_newest = header[0];
+        }
+
+        arq_handle_ack(header[1], header[2], fresh);
+        arq_catch_up(header[3]);
+
+        // Nothing else in it
+        if (packet->payloadSize == LINK_HEADER_LEN + ARQ_HEADER_LEN) {
+            continue;
+        }
+
+        // Every data frame gets acknowledged, even a duplicate
+        if (!ack_due) {
+            ack_due = 1;
+            ack_deadline = getTicks() + ARQ_ACK_DELAY;
+        }
+
+        if (!arq_accept(header[0], packet->payload[0] & LINK_FRAG)) {
+            continue;
+        }
+
+        // Hand over the rest without the ARQ header
+        packet->payloadSize -= ARQ_HEADER_LEN;
+        packet->payload[0]  &= ~LINK_ARQ;
+        memmove(header, header + ARQ_HEADER_LEN, packet->payloadSize - LINK_HEADER_LEN);
+
+        return packet;
+    }
+
+    return 0;
+}
+
+void arqPoll(void)
+{
+    uint16_t now = getTicks();
+    uint8_t  seq;
+
+    for (seq = tx_base; seq != tx_next; seq++) {
+        arq_entry_t *entry = &arq_sent[seq % ARQ_WINDOW_MAX];
+
+        if (entry->flags & ARQ_ACKED) {
+            continue;
+        }
+
+        // The timer starts when the frame is off the air
+        if (MRF_frame_busy(entry->frame)) {
+            entry->deadline = now + arq_timeout;
+            continue;
+        }
+
+        if ((int16_t)(now - entry->deadline) < 0) {
+            continue;
+        }
+
+        if (++entry->retries > ARQ_RETRY_MAX) {
+            arq_acked(seq);
+            arq_stats.giveUps++;
+            arq_header_soon();      // With the new base
+            continue;
+        }
+
+        entry->deadline = now + arq_timeout;
+        MRF_frame_resend(entry->frame);
+        arq_stats.retransmits++;
+    }
+
+    arq_advance();
+
+    // No data went the other way in time to carry the acknowledgement.
+    // The frame is encoded into the transmit buffer when it's queued, so
+    // it only needs to live on the stack until then.
+    if (ack_due && (int16_t)(now - ack_deadline) >= 0) {
+        MRF_packet_t ack;
+
+        ack.payloadSize = LINK_HEADER_LEN + ARQ_HEADER_LEN;
+        ack.type = PACKET_TYPE_LINK;
+        ack.payload[0] = 0;
+        arq_header(&ack, tx_next);
+        adaptTag(&ack);
+
+        if (MRF_transmit_packet(&ack)) {
+            ack_due = 0;
+        }
+    }
+}
+
+void arqStop(void)
+{
+    while (tx_base != tx_next) {
+        if (!(arq_sent[tx_base % ARQ_WINDOW_MAX].flags & ARQ_ACKED)) {
+            arq_stats.giveUps++;
+        }
+        arq_acked(tx_base);
+        tx_base++;
+    }
+
+    ack_due = 0;
+}
+
+uint8_t arqSkipped(void)
+{
+    uint8_t skipped = rx_skipped;
+    rx_skipped = 0;
+    return skipped;
+}
+
+void arqGetStats(ARQ_stats_t *stats)
+{
+    *stats = arq_stats;
+}
+
+#else
+
+// Left out of the build.  Frames from a side using ARQ still have their
+// ARQ header taken off, so their data gets through (the other side never
+// hears an acknowledgement, so it sends each one again until it gives up,
+// and the copies are passed on too).
+void arqConfigure(uint16_t linkopt)
+{
+    (void)linkopt;
+}
+
+uint8_t arqEnabled(void)
+{
+    return 0;
+}
+
+uint8_t arqSend(MRF_packet_t *packet)
+{
+    (void)packet;
+    return 0;
+}
+
+MRF_packet_t* arqReceive(void)
+{
+    MRF_packet_t *packet;
+    uint8_t *header;
+
+    while ((packet = tdmaReceive()) != 0) {
+        if ((packet->type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK ||
+            !(packet->payload[0] & LINK_ARQ)) {
+            return packet;
+        }
+
+        // Only an acknowledgement
+        if (packet->payloadSize <= LINK_HEADER_LEN + ARQ_HEADER_LEN) {
+            continue;
+        }
+
+        header = &packet->payload[LINK_HEADER_LEN];
+        packet->payloadSize -= ARQ_HEADER_LEN;
+        packet->payload[0]  &= ~LINK_ARQ;
+        memmove(header, header + ARQ_HEADER_LEN, packet->payloadSize - LINK_HEADER_LEN);
+
+        return packet;
+    }
+
+    return 0;
+}
+
+void arqPoll(void)
+{
+}
+
+void arqStop(void)
+{
+}
+
+uint8_t arqSkipped(void)
+{
+    return 0;
+}
+
+void arqGetStats(ARQ_stats_t *stats)
+{
+    memset(stats, 0, sizeof(ARQ_stats_t));
+}
+
+#endif
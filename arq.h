@@ -0,0 +1,92 @@
+//
+//  arq.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_arq_h
+#define MRF49XA_Dongle_arq_h
+
+#include <stdint.h>
+#include "MRF49XA.h"
+#include "link.h"
+
+// Selective-repeat ARQ for the packet modes.
+//
+// Frames sent reliably are link frames with LINK_ARQ set (and always have
+// PACKET_FLAG_CRC).  The link header is followed by a 4 byte ARQ header:
+//
+//   seq   Sequence number of this frame
+//   ack   Next sequence number we're waiting for from the other side
+//   sack  Bit i set if frame ack + i has arrived (out of order)
+//   base  Oldest frame we're still sending, we've stopped sending anything
+//         before it (it was acknowledged, or we gave up on it)
+//
+// A frame with nothing after the headers is only an acknowledgement.
+// Acknowledgements ride along on data going the other way when there is
+// some, otherwise one is sent on its own after ARQ_ACK_DELAY ticks.  A
+// frame missing from below the highest bit of the sack field is sent again
+// straight away, the rest are sent again after the retry timeout.
+//
+// Sent frames are kept in the radio's transmit buffer until they're
+// acknowledged, so there's no second copy.  Received frames are handed to
+// the app as soon as they arrive, and only once.  After a loss that can be
+// out of order, there's no RAM to hold frames back.  Fragments (link.h)
+// are the exception, they're only taken in order.
+//
+// A frame sent again is sent as it was queued, header and all, so only
+// headers of frames with a sequence number at least as new as any seen
+// before are taken as current.  Older ones only acknowledge frames.
+//
+// A receiver waiting for a frame before the other side's base stops
+// waiting, and moves up to it.  After giving up on a frame, and whenever
+// an acknowledgement shows the other side still waiting for one, a sender
+// sends a fresh header straight away so that this happens quickly.
+#define ARQ_HEADER_LEN      4
+
+// The window can't be larger than the sack field
+#define ARQ_WINDOW_MAX      8
+#define ARQ_WINDOW_DEFAULT  4
+#define ARQ_TIMEOUT_DEFAULT 24      // Ticks (8.192 mS each), about 200 mS
+#define ARQ_RETRY_MAX       8       // Sends after the first, then give up
+#define ARQ_ACK_DELAY       2       // Ticks to wait for data to carry an ack
+
+// From the link options (link.h)
+#define ARQ_LINKOPT_WINDOW(opt)     (((opt) >> 8) & 0x0F)
+#define ARQ_LINKOPT_TIMEOUT(opt)    (((opt) >> 12) << 4)
+
+typedef struct {
+    uint16_t retransmits;   // Frames sent again
+    uint16_t giveUps;       // Frames dropped after ARQ_RETRY_MAX retries
+    uint16_t duplicates;    // Frames received again, not passed on
+    uint16_t skipped;       // Frames the other side gave up on
+} ARQ_stats_t;
+
+void    arqConfigure(uint16_t linkopt);
+uint8_t arqEnabled(void);
+
+// Send a link frame reliably.  The link header must be filled in, and
+// followed by ARQ_HEADER_LEN bytes of room for the ARQ header.  Returns 0
+// if the window or the transmit buffer is full, try again later.
+uint8_t arqSend(MRF_packet_t *packet);
+
+// The next packet for the app.  The ARQ header is removed (and LINK_ARQ
+// cleared), anything else is passed through.  Valid until the next call.
+MRF_packet_t* arqReceive(void);
+
+// Retry timers and acknowledgements, call this often from the main loop
+void arqPoll(void);
+
+// Leaving the packet modes, nothing calls arqPoll() after this.  Gives up
+// on the outstanding frames, so they don't hold transmit buffer space.
+void arqStop(void);
+
+// 1 if the other side has given up on frames we were waiting for, since
+// the last call.  Anything they were part of isn't coming.
+uint8_t arqSkipped(void);
+
+void arqGetStats(ARQ_stats_t *stats);
+
+#endif
@@ -8,10 +8,23 @@
 
 // This program can generate lookup tables for 8,4 hamming ECC.
 // replace the following matricies with your generator and check
-// matricies and run the program.  Also, you can tweak the speculative
-// correction code for cases with more than 1 error.
+// matricies and run the program.
+//
+// The build runs it to make hamming_tables.h, which hamming.c includes.
+// The argument picks the decoder:
+//
+//   secded  Correct single bit errors, and flag double bit errors as
+//           erased (the data nibble is left as it was received)
+//   sec     Correct single bit errors, double bit errors aren't flagged
+//
+// With a distance 4 code, three bit errors look exactly like single bit
+// errors (they're one bit from another codeword), so no table can tell
+// them apart.
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "hamming.h"
 
 uint8_t apply_gen_matrix(uint8_t input, uint8_t matrix[4]);
 uint8_t apply_check_matrix(uint8_t input, uint8_t matrix[8]);
@@ -109,71 +122,73 @@ uint8_t get_hamming_distance(uint8_t a, uint8_t b)
 
 int main (int argc, const char * argv[])
 {
-    uint16_t counts[16] = {0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0};
-    
-    uint8_t i;
-    
+    uint8_t secded = 1;
+    uint16_t i;
     uint8_t codewords[16];
     
-    printf("Generator table:\n");
+    if (argc > 1 && strcmp(argv[1], "sec") == 0) {
+        secded = 0;
+    } else if (argc > 1 && strcmp(argv[1], "secded") != 0) {
+        fprintf(stderr, "usage: %s [secded|sec] > hamming_tables.h\n", argv[0]);
+        return 1;
+    }
+    
+    // The table needs every codeword at least 4 bits from every other one
     for (i = 0; i < 16; i++) {
-        uint8_t output = apply_gen_matrix(i, gen_matrix);
-        printf("0x%02x\n", output);
-        codewords[i] = output;
+        codewords[i] = apply_gen_matrix(i, gen_matrix);
+        
+        if (apply_check_matrix(codewords[i], check_matrix) != 0) {
+            fprintf(stderr, "codeword 0x%02x fails the check matrix\n", codewords[i]);
+            return 1;
+        }
+    }
+    
+    for (i = 0; i < 16 * 16; i++) {
+        uint8_t a = i >> 4, b = i & 0x0F;
+        if (a != b && get_hamming_distance(codewords[a], codewords[b]) < 4) {
+            fprintf(stderr, "codewords 0x%02x and 0x%02x are too close\n",
+                    codewords[a], codewords[b]);
+            return 1;
+        }
     }
     
-    printf("\nCheck table:\n");
-    uint8_t j;
+    printf("// Generated by generate-tables.c (%s), don't edit\n\n",
+           secded ? "secded" : "sec");
+    printf("#define HAMMING_SECDED %d\n\n", secded);
+    
+    printf("static const uint8_t generator[16] PROGMEM = {");
     for (i = 0; i < 16; i++) {
-        for (j = 0; j < 16; j++) {
-            uint8_t codeword = (i << 4) | j;
-            uint8_t output = apply_check_matrix(codeword, check_matrix);
-            uint8_t value = 0;
+        printf("%s0x%02X", (i == 0) ? "\n    " : (i % 8) ? ", " : ",\n    ", codewords[i]);
+    }
+    printf("\n};\n\n");
+    
+    // Each entry is the data nibble, with HAMMING_CORRECTED or
+    // HAMMING_ERASED above it
+    printf("static const uint8_t check[256] PROGMEM = {");
+    for (i = 0; i < 256; i++) {
+        uint8_t codeword = i;
+        uint8_t syndrome = apply_check_matrix(codeword, check_matrix);
+        uint8_t flags = 0;
+        uint8_t k;
+        
+        // If the syndrome matches a column of the check matrix, that's the
+        // bit that needs to be flipped.  If it doesn't, two bits are wrong
+        // and there's no telling which.
+        if (syndrome != 0) {
+            flags = (secded) ? HAMMING_ERASED : 0;
             
-            // If the syndrome is not zero, attempt to fix the error
-            if (output != 0) {
-                uint8_t k;
-                
-                // Calculate the hamming distance between
-                // this message and the codewords.
-                // Select the lowest distance codeword,
-                // break ties with the data part of the codeword
-                uint8_t distances[16];
-                for (k = 0; k < 16; k++) {
-                    distances[k] = get_hamming_distance(codeword, codewords[k]);
-                }
-                
-                // Keep the symptom as the higher order bits (for diag)
-                value = output << 4;
-                
-                // Check each column of the check matrix
-                // if there is a matching column, its index
-                // is the bit position that needs to be flipped
-                // If there isn't one, then all is lost.
-                for (k = 0; k < 8; k++) {
-                    if (check_matrix[k] == output) {
-                        codeword = codeword ^ (1 << (7-k));
-                    }
+            for (k = 0; k < 8; k++) {
+                if (check_matrix[k] == syndrome) {
+                    codeword ^= (1 << (7 - k));
+                    flags = HAMMING_CORRECTED;
                 }
-                
             }
-            
-            // Set the low-order bits to the value
-            value |= (codeword >> 4) & 0x0F;
-            
-            // Count the number of times we get this value
-            counts[(value & 0x0F)] += 1;
-            
-            // Print the output
-            printf("0x%02x, ", value);
         }
-        printf("\n");
-    }    
-    
-    for (i = 0; i < 16; i++) {
-        printf("Number of 0x%x's: %d\n", i, counts[i]);
+        
+        printf("%s0x%02x", (i == 0) ? "\n    " : (i % 16) ? ", " : ",\n    ",
+               flags | (codeword >> 4));
     }
+    printf("\n};\n");
     
     return 0;
 }
-
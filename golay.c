@@ -0,0 +1,108 @@
+//
+//  golay.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#include "golay.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(value) *(value)
+#endif
+
+// The parity part of the generator matrix, [I | B].  B is its own inverse
+// and its own transpose, which is what makes the decoder this short.  Row i
+// goes with bit 11 - i.
+static const uint16_t golay_b[12] PROGMEM = {
+    0xDC5, 0xB8B, 0x717, 0xE2D, 0xC5B, 0x8B7,
+    0x16F, 0x2DD, 0x5B9, 0xB71, 0x6E3, 0xFFE
+};
+
+static uint8_t weight(uint16_t x)
+{
+    uint8_t count = 0;
+
+    while (x) {
+        x &= x - 1;
+        count++;
+    }
+
+    return count;
+}
+
+// x * B
+static uint16_t golay_mul(uint16_t x)
+{
+    uint16_t result = 0;
+    uint8_t  i;
+
+    for (i = 0; i < 12; i++) {
+        if (x & (0x800 >> i)) {
+            result ^= pgm_read_word(&golay_b[i]);
+        }
+    }
+
+    return result;
+}
+
+uint32_t golay_encode(uint16_t data)
+{
+    data &= 0xFFF;
+    return ((uint32_t)data << 12) | golay_mul(data);
+}
+
+// The syndrome decoder from Lin and Costello.  For a received word (x, y)
+// the syndrome is s = xB + y.  If the errors are all in the parity half
+// (or all but one) the syndrome shows them directly.  Otherwise they're
+// mostly in the data half, and sB shows them.
+int8_t golay_decode(uint32_t *codeword)
+{
+    uint16_t x = (*codeword >> 12) & 0xFFF;
+    uint16_t y = *codeword & 0xFFF;
+    uint16_t s = golay_mul(x) ^ y;
+    uint16_t ex, ey;
+    uint8_t  i;
+
+    if (weight(s) <= 3) {
+        ex = 0;
+        ey = s;
+        goto corrected;
+    }
+
+    for (i = 0; i < 12; i++) {
+        uint16_t t = s ^ pgm_read_word(&golay_b[i]);
+        if (weight(t) <= 2) {
+            ex = 0x800 >> i;
+            ey = t;
+            goto corrected;
+        }
+    }
+
+    s = golay_mul(s);
+
+    if (weight(s) <= 3) {
+        ex = s;
+        ey = 0;
+        goto corrected;
+    }
+
+    for (i = 0; i < 12; i++) {
+        uint16_t t = s ^ pgm_read_word(&golay_b[i]);
+        if (weight(t) <= 2) {
+            ex = t;
+            ey = 0x800 >> i;
+            goto corrected;
+        }
+    }
+
+    return -1;
+
+corrected:
+    *codeword = ((uint32_t)(x ^ ex) << 12) | (y ^ ey);
+    return weight(ex) + weight(ey);
+}
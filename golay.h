@@ -0,0 +1,29 @@
+//
+//  golay.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_golay_h
+#define MRF49XA_Dongle_golay_h
+
+#include <stdint.h>
+
+// The extended Golay (24,12) code.  Each 12 bit chunk of data is sent as a
+// 24 bit codeword, the data followed by 12 parity bits.  Any 3 bad bits in
+// a codeword are corrected, and 4 are detected.
+//
+// Bytes are coded 3 at a time as two codewords (6 bytes), so a block of n
+// bytes takes GOLAY_CODED_LEN(n) bytes on the air.  A partial chunk at the
+// end is padded with zeros.
+#define GOLAY_CODED_LEN(n)  (3 * ((2 * (uint16_t)(n) + 2) / 3))
+
+uint32_t golay_encode(uint16_t data);
+
+// Correct a codeword in place, the data is then in bits 23-12.  Returns the
+// number of bits corrected, or -1 if there were too many.
+int8_t   golay_decode(uint32_t *codeword);
+
+#endif
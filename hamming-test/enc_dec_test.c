@@ -5,75 +5,107 @@
 //  Created by William Dillon on 3/11/14.
 //  Copyright (c) 2014 Oregon State University (COAS). All rights reserved.
 //
+//  Checks the generated hamming tables against every codeword and every
+//  error pattern.  Built and run on the host by "make hamming-verify".
+//
 
 #include <stdio.h>
+#include <stdint.h>
 #include "../hamming.h"
 
+// Only for HAMMING_SECDED, the tables themselves are tested through hamming.c
+#define PROGMEM
+#include "../hamming_tables.h"
+
+static int bits(uint8_t value)
+{
+    int count = 0;
+
+    while (value) {
+        count += value & 1;
+        value >>= 1;
+    }
+
+    return count;
+}
+
 int
-main(int argc, char **argv)
+main(void)
 {
-    int casesTested  = 0;
-    int casesSucceed = 0;
-
-    // Test basic encoding and decoding
-//    for (int i = 0; i < 255; i++) {
-//        printf("Encoding 0x%x: 0x%x, decoded as: 0x%x\n",
-//               i,
-//               hamming_encode(i),
-//               hamming_decode(hamming_encode(i)));
-//    }
-    
-    // Test decoding with single bit errors
-    // Input byte
-    for (int i = 0; i < 255; i++) {
-        uint16_t symbol = hamming_encode(i);
-
-        // Flipped bit position
-        for (int j = 0; j < 8; j++) {
-            casesTested++;
-            
-            if (hamming_decode(symbol ^ (1 << j)) != i) {
-                printf("FAILED TO CORRECT SINGLE BIT ERROR (bit %d), 0x%x: 0x%x != 0x%x\n",
-                       j, symbol, hamming_decode(symbol ^ (1 << j)), i);
-            } else {
-                casesSucceed++;
+    int tested[9]  = {0};
+    int failed[9]  = {0};
+    int flagged[9] = {0};
+
+    // Every data nibble, with every pattern of bad bits
+    for (int nibble = 0; nibble < 16; nibble++) {
+        uint8_t codeword = hamming_encode_nibble(nibble);
+
+        for (int pattern = 0; pattern < 256; pattern++) {
+            int errors = bits(pattern);
+            uint8_t result = hamming_decode_nibble_status(codeword ^ pattern);
+            uint8_t value  = result & 0x0F;
+            int ok;
+
+            if (result & HAMMING_ERASED) {
+                flagged[errors]++;
             }
-        }
-    }
 
-    printf("Tested %d single-bit error conditions, %f%% corrected.\n",
-           casesTested, (float)casesSucceed / (float)casesTested * 100.);
-    
-    // Test decoding with double bit errors
-    // Input byte
-    casesTested  = 0;
-    casesSucceed = 0;
-    for (int i = 0; i < 255; i++) {
-        uint16_t symbol = hamming_encode(i);
-        
-        // Flipped bit position 1
-        for (int j = 0; j < 16; j++) {
-            
-            // Flipped bit position 2
-            for (int k = 0; k < 16; k++) {
-                // If they're the same bit, skip it.
-                if (k == j) k++;
-                casesTested++;
-
-                uint16_t symptom = (1 << j) | (1 << k);
-                
-                if (hamming_decode(symbol ^ symptom) != i) {
-//                    printf("FAILED TO CORRECT DOUBLE BIT ERROR (bit %d and %d), 0x%x: 0x%x != 0x%x\n",
-//                           j, k, symbol, hamming_decode(symbol ^ symptom), i);
-                } else {
-                    casesSucceed++;
+            switch (errors) {
+                case 0:
+                    ok = (result == nibble);
+                    break;
+                case 1:
+                    ok = (value == nibble) && (result & HAMMING_CORRECTED);
+                    break;
+                case 2:
+                    // SECDED must flag every one, never "correct" it
+                    ok = !HAMMING_SECDED ||
+                         ((result & HAMMING_ERASED) &&
+                          !(result & HAMMING_CORRECTED));
+                    break;
+                default:
+                    // Past what the code promises, these are only counted
+                    ok = 1;
+                    break;
+            }
+
+            tested[errors]++;
+            if (!ok) {
+                failed[errors]++;
+                if (failed[errors] <= 4) {
+                    printf("FAILED: nibble 0x%x, errors 0x%02x, decoded 0x%02x\n",
+                           nibble, pattern, result);
                 }
             }
         }
     }
-    
-    printf("Tested %d double-bit error conditions, %f%% corrected.\n",
-           casesTested, (float)casesSucceed / (float)casesTested * 100.);
-    
 
-}
\ No newline at end of file
+    // Every byte through the two nibble encoding
+    for (int byte = 0; byte < 256; byte++) {
+        tested[0]++;
+        if (hamming_decode_byte(hamming_encode_byte(byte)) != byte) {
+            failed[0]++;
+            printf("FAILED: byte 0x%02x doesn't survive encoding\n", byte);
+        }
+    }
+
+    int total = 0;
+
+    // Belt and braces on the erasure count, which the receiver relies on
+    if (HAMMING_SECDED && flagged[2] != tested[2]) {
+        printf("FAILED: only %d of %d double bit errors flagged\n",
+               flagged[2], tested[2]);
+        total++;
+    }
+
+    for (int errors = 0; errors <= 8; errors++) {
+        printf("%d bit errors: %5d tested, %5d failed, %5d flagged erased\n",
+               errors, tested[errors], failed[errors], flagged[errors]);
+        total += failed[errors];
+    }
+
+    printf("%s (%s tables)\n", total ? "FAILED" : "PASSED",
+           HAMMING_SECDED ? "secded" : "sec");
+
+    return total ? 1 : 0;
+}
@@ -17,4 +17,11 @@ uint16_t hamming_encode_byte(uint8_t  byte);
 uint8_t  hamming_decode_nibble(uint8_t byte);
 uint8_t  hamming_decode_byte(uint16_t symbol);
 
+// The decoded nibble, with a flag saying whether it was corrected (a single
+// bit error) or is only a guess (a double bit error, an erasure)
+#define HAMMING_CORRECTED   0x10
+#define HAMMING_ERASED      0x20
+
+uint8_t  hamming_decode_nibble_status(uint8_t byte);
+
 #endif
@@ -17,8 +17,14 @@
 
 /* These defines are included for the SPI library
  *
+ * The MRF49XA is wired to the hardware SPI pins, so the SPI peripheral is
+ * used by default.  To bit-bang the bus instead (for example, on a board
+ * that uses other pins) build with SOFTWARE_SPI defined, e.g. by adding
+ * -DSOFTWARE_SPI to CDEFS in the makefile.
  */ 
-#define SOFTWARE_SPI
+#define SPI_SS_PORTx	PORTB
+#define SPI_SS_DDRx		DDRB
+#define SPI_SS_BIT		0
 
 #define SPI_MISO_PORTx	PORTB
 #define SPI_MISO_PINx	PINB
@@ -73,6 +79,7 @@
 // These are macros for setting up the interrupts for the MRF
 #define MRF_INT_SETUP()	EICRB |= (1 << ISC41)
 #define MRF_INT_MASK()	EIMSK |= (1 << INT4)
+#define MRF_INT_PENDING() (EIFR & (1 << INTF4))
 
 /*******************************************************************************
  * These defines set either the soldered-on characteristics of the MRF module,
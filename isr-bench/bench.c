@@ -0,0 +1,193 @@
+//
+//  bench.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+// Bench firmware for the IRO interrupt timing check (make isr-bench).  It
+// runs the radio driver on its own, without USB, under mrf_sim, which
+// stands in for the MRF49XA and loops every frame sent back into the
+// receiver.  Each coding the driver knows is sent (one frame at a time,
+// then a burst of back to back frames) with plain and coded headers, so
+// every path through the ISR gets exercised in both directions.
+//
+// The results go out a character at a time through GPIOR0, which mrf_sim
+// prints: a line per frame that didn't come back intact, then the driver's
+// own worst case cycles per ISR state.  Sleeping with interrupts off ends
+// the simulation.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "MRF49XA.h"
+#include "spi.h"
+
+#define BENCH_BURST     3       // Frames sent back to back
+#define BENCH_TIMEOUT   25      // Ticks to wait for a burst to come back
+
+static const uint8_t codings[] = {
+    PACKET_FEC_DEFAULT,
+    PACKET_FEC_DEFAULT | PACKET_FLAG_CRC,
+    PACKET_FEC_HAMMING | PACKET_FLAG_CRC,
+    PACKET_FEC_HAMMING | PACKET_FLAG_CRC | PACKET_FLAG_INTERLEAVE,
+    PACKET_FEC_HAMMING | PACKET_FLAG_CRC | PACKET_FLAG_WHITEN |
+                         PACKET_FLAG_INTERLEAVE,
+    PACKET_FEC_GOLAY   | PACKET_FLAG_CRC,
+    PACKET_FEC_GOLAY   | PACKET_FLAG_CRC | PACKET_FLAG_WHITEN |
+                         PACKET_FLAG_INTERLEAVE,
+#ifndef MRF_NO_RS
+    PACKET_FEC_RS      | PACKET_FLAG_CRC,
+    PACKET_FEC_RS      | PACKET_FLAG_CRC | PACKET_FLAG_WHITEN,
+#endif
+};
+
+static volatile uint8_t ticks;
+static MRF_packet_t packet;
+
+// The same 8.192 mS tick as main.c, so the driver's critical sections and
+// the tick's own register writes get in the ISR's way as they would there
+ISR(TIMER0_OVF_vect, ISR_NOBLOCK)
+{
+    ticks++;
+    MRF_tick();
+}
+
+static void bench_putc(uint8_t c)
+{
+    GPIOR0 = c;
+}
+
+static void bench_puts(const char *s)
+{
+    while (*s) {
+        bench_putc(*s++);
+    }
+}
+
+static void bench_dec(uint16_t value)
+{
+    char digits[6];
+    uint8_t i = 0;
+
+    do {
+        digits[i++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (i) {
+        bench_putc(digits[--i]);
+    }
+}
+
+static void bench_fill(uint8_t coding, uint8_t n)
+{
+    packet.payloadSize = MRF_PAYLOAD_LEN;
+    packet.type        = PACKET_TYPE_PACKET | coding;
+
+    for (uint8_t i = 0; i < MRF_PAYLOAD_LEN; i++) {
+        packet.payload[i] = coding ^ (n << 4) ^ (i * 0x3B);
+    }
+}
+
+// Send count frames of one coding, and wait for them to come back.
+// Returns the number that didn't.
+static uint8_t bench_run(uint8_t coding, uint8_t count)
+{
+    uint8_t sent     = 0;
+    uint8_t received = 0;
+    uint8_t start    = ticks;
+
+    while (received < count && (uint8_t)(ticks - start) < BENCH_TIMEOUT) {
+        // Queue as many as fit once the last lot is back, so those go out
+        // back to back and nothing is sent while they're being received
+        if (sent == received) {
+            while (sent < count) {
+                bench_fill(coding, sent);
+                if (!MRF_transmit_packet(&packet)) {
+                    break;
+                }
+                sent++;
+            }
+        }
+
+        MRF_packet_t *rx = MRF_receive_packet();
+        if (rx == NULL) {
+            continue;
+        }
+
+        // Frames come back in the order they were sent
+        bench_fill(coding, received);
+        if (rx->payloadSize == packet.payloadSize &&
+            memcmp(rx->payload, packet.payload, packet.payloadSize) == 0) {
+            received++;
+        } else {
+            break;
+        }
+    }
+
+    return count - received;
+}
+
+int main(void)
+{
+    TCCR0A = 0x00;  // As main.c, divide-by 256 overflow every 8.192 mS
+    TCCR0B = 0x04;
+    TIMSK0 = 0x01;
+
+    spi_init();
+    MRF_init();
+    sei();
+
+    uint8_t failed = 0;
+
+    for (uint8_t header = 0; header < 2; header++) {
+        MRF_set_coded_header(header);
+
+        for (uint8_t i = 0; i < sizeof(codings); i++) {
+            for (uint8_t burst = 0; burst < 2; burst++) {
+                uint8_t count = burst ? BENCH_BURST : 1;
+                uint8_t lost = bench_run(codings[i], count);
+                if (lost) {
+                    bench_puts("lost ");
+                    bench_dec(lost);
+                    bench_puts(" of ");
+                    bench_dec(count);
+                    bench_puts(", coding 0x");
+                    bench_putc("0123456789ABCDEF"[codings[i] >> 4]);
+                    bench_putc("0123456789ABCDEF"[codings[i] & 0x0F]);
+                    bench_puts(header ? ", coded header\n" : "\n");
+                    failed++;
+                }
+            }
+        }
+    }
+
+    MRF_stats_t stats;
+    MRF_get_stats(&stats);
+
+    // In the order of MRF_stats_t's isrCycles
+    static const char *const states[MRF_ISR_STATES] = {
+        "idle", "tx", "rx", "header"
+    };
+
+    for (uint8_t i = 0; i < MRF_ISR_STATES; i++) {
+        bench_puts("driver ");
+        bench_puts(states[i]);
+        bench_putc(' ');
+        bench_dec(stats.isrCycles[i]);
+        bench_putc('\n');
+    }
+
+    bench_puts(failed ? "FAILED\n" : "done\n");
+
+    cli();
+    sleep_enable();
+    sleep_cpu();
+
+    return 0;
+}
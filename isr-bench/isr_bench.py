@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+#
+#  isr_bench.py
+#  MRF49XA-Dongle
+#
+#  Reads the worst case IRO interrupt timing recorded by a dongle, and checks
+#  it against the time available per byte at a given bit rate.
+#
+#  The dongle has to be built without MRF_NO_STATS, and be in the top
+#  level menu.  Run some traffic through it
+#  first (e.g. another dongle in packet mode, with this one in the test
+#  menu's print or echo mode), so that every ISR state has been exercised.
+#
+#  The dongle only times the ISR's own work.  The rest of the time from the
+#  FIFO flag to the byte being serviced (waiting for main's critical
+#  sections and the timer interrupt, and the ISR's entry and exit) comes
+#  from the simulated run, "make isr-bench", which prints both numbers for
+#  the same build as "Worst latency L cycles ..., entry and exit E".
+#
+#  usage: isr_bench.py /dev/tty.usbmodemXXXX latency entry_exit [bitrate]
+#
+
+from __future__ import print_function
+
+import re
+import sys
+import time
+
+import serial
+
+F_CPU = 8000000
+
+STATES = ("idle", "tx", "rx", "header")
+
+def read_stats(port):
+    link = serial.Serial(port, 115200, timeout=1)
+
+    # Enter the test menu, print the link statistics, and leave again
+    link.write(b"2")
+    time.sleep(0.2)
+    link.reset_input_buffer()
+    link.write(b"6")
+    time.sleep(0.5)
+    text = link.read(link.in_waiting).decode("ascii", "replace")
+    link.write(b"x")
+    link.close()
+
+    match = re.search(r"ISR worst case cycles \([^)]*\): ([0-9 ]+)", text)
+    if match is None:
+        raise RuntimeError("No ISR timing in the dongle's response:\n" + text)
+
+    return [int(value) for value in match.group(1).split()]
+
+def main(argv):
+    if len(argv) < 4:
+        print("usage: isr_bench.py port latency entry_exit [bitrate]")
+        return 2
+
+    port       = argv[1]
+    latency    = int(argv[2])
+    entry_exit = int(argv[3])
+    bitrate    = int(argv[4]) if len(argv) > 4 else 9579
+
+    cycles = read_stats(port)
+
+    # One byte time, less the parts of the latency that aren't the ISR's
+    byte_cycles = 8 * F_CPU // bitrate
+    budget      = byte_cycles - latency - entry_exit
+
+    print("Byte time at %d bps: %d cycles, ISR budget %d cycles" %
+          (bitrate, byte_cycles, budget))
+
+    worst  = 0
+    failed = False
+    for name, value in zip(STATES, cycles):
+        verdict = "ok"
+        if value == 0:
+            verdict = "not exercised"
+        elif value > budget:
+            verdict = "OVER BUDGET"
+            failed  = True
+
+        print("  %-7s %5d cycles  %s" % (name, value, verdict))
+        worst = max(worst, value)
+
+    if worst > 0:
+        limit = 8 * F_CPU // (worst + latency + entry_exit)
+        print("Maximum sustainable bit rate: about %d bps" % limit)
+
+    return 1 if failed else 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,651 @@
+//
+//  mrf_sim.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+// Times the IRO interrupt on a simulated at90usb162 (simavr), running the
+// bench firmware in bench.c.  This stands in for the MRF49XA at the pins:
+// it answers the SPI register commands, raises the FIFO flag on MISO and
+// pulls IRO low when a byte is due, and plays every transmission back into
+// the receiver once the transmitter is turned off.  Bytes go on and off the
+// air at the bit rate the firmware set in DRSREG.
+//
+// For every IRO interrupt it records the cycles from entry to the reti, and
+// for every byte the response time, from the flag going up to the FIFO
+// read or TX register write that takes it down again.  The response time
+// includes waiting for main's critical sections and the other interrupts,
+// so it's the number that has to fit in a byte time (see the interrupt
+// budget in MRF49XA.h).
+//
+// The bench is built with SOFTWARE_SPI, because simavr doesn't clock its
+// SPI peripheral at the configured rate.  The register accesses are timed
+// from the SCK edges, so the numbers are also given with each one's clocking
+// replaced by the hardware SPI's (HW_SPI_CYCLES), which is what the normal
+// build does.  The limits are checked against those, unless -x says the
+// firmware is bit-banged as well.
+//
+// usage: mrf_sim [-b bitrate] [-s cycles] [-x] bench.elf
+//
+//   -b  The bit rate to check the worst case against (default BITRATE)
+//   -s  Cycles of SPI clocking in one hardware register access, from menu
+//       option 7 on a board less the call (default HW_SPI_CYCLES)
+//   -x  Check the bit-banged numbers, for a SOFTWARE_SPI firmware
+//
+// Exits with 1 if any byte was lost, any frame didn't come back, or the
+// worst case doesn't fit a byte time at the bit rate checked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_ioport.h>
+
+#include "MRF49XA_definitions.h"
+
+#define F_CPU           8000000
+
+// The fastest entry in rate.c's table
+#define BITRATE         38314
+
+// Two bytes at F_CPU/4, and polling SPIF for each
+#define HW_SPI_CYCLES   (2 * 8 * 4 + 2 * 6)
+
+// The pins, as in hardware.h
+#define SCK_PIN         1       // Port B
+#define MOSI_PIN        2
+#define MISO_PIN        3
+#define CS_PIN          4
+#define IRO_PIN         7       // Port C, INT4
+#define IRO_VECTOR      5       // INT4_vect_num on the at90usb162
+#define CONSOLE_ADDR    0x3E    // GPIOR0, written by bench.c
+
+// Simulated time the bench gets to finish
+#define SIM_SECONDS     60
+
+#define AIR_LEN         1024    // One burst of frames, as sent
+#define SYNC_WORD       0x2DD4
+
+enum { PHASE_TX, PHASE_RX_FIRST, PHASE_RX, PHASES };
+static const char *const phase_names[PHASES] = { "tx", "rx first byte", "rx" };
+
+static avr_t *avr;
+static avr_irq_t *miso_irq, *iro_irq;
+
+static uint32_t byte_cycles;    // At the rate in DRSREG
+static uint32_t hw_spi_cycles = HW_SPI_CYCLES;
+
+// The radio
+static struct {
+    uint8_t  cs, mosi;
+    uint8_t  bits;          // Clocked in this access
+    uint16_t in, out;
+
+    uint8_t  txcen, rxcen;  // PMCREG
+    uint8_t  txden, fifoen; // GENCREG
+    uint8_t  fscf;          // FIFORSTREG
+
+    uint8_t  flag;          // TXRXFIFO, the FIFO or TX register wants service
+    uint8_t  overflow;      // TXOWRXOF, until the next status read
+
+    uint8_t  tx_full;       // Bytes in the TX register
+    uint8_t  tx_byte;
+
+    uint8_t  synced;        // Past the sync word, filling the FIFO
+    uint16_t shift;         // Looking for the sync word
+    uint8_t  fifo[2];
+    uint8_t  fifo_phase[2];
+    avr_cycle_count_t fifo_time[2];     // When each byte arrived
+    int64_t  fifo_saved[2];
+    uint8_t  fifo_count;
+    uint16_t rx_index;      // Bytes into the FIFO since the sync word
+
+    uint8_t  air[AIR_LEN];
+    uint16_t air_len, air_pos;
+    uint8_t  replaying;
+} mrf;
+
+// Cycles saved so far by clocking each SPI access as the hardware would.
+// Any interval's hardware SPI length is its length less the change in this.
+static int64_t spi_saved;
+static avr_cycle_count_t sck_last;
+
+// What's being timed
+static avr_cycle_count_t flag_up;       // When the flag went up
+static uint8_t           flag_phase;
+static int64_t           flag_saved;
+static avr_cycle_count_t isr_entry;
+static int64_t           isr_saved;
+static uint8_t           isr_phase;
+static uint8_t           isr_bytes;     // Serviced in this interrupt
+static uint8_t           isr_active;
+static avr_cycle_count_t isr_cs_first;  // CS edges inside it
+static avr_cycle_count_t isr_cs_last;
+
+static struct {
+    uint32_t isr[2];        // Per byte, bit-banged and hardware SPI
+    uint32_t response[2];
+    uint32_t count;
+} worst[PHASES];
+
+static uint32_t worst_latency[2];   // Flag up to the interrupt's entry
+static uint32_t worst_entry_exit;   // Around the driver's own timing
+
+static uint32_t overruns, underruns, frames;
+static int      bench_failed, bench_done;
+static char     line[128];
+static size_t   line_len;
+
+static void set_miso(void)
+{
+    uint8_t level = 0;
+
+    if (!mrf.cs) {
+        if (mrf.bits == 0) {
+            level = mrf.flag;
+        } else if (mrf.bits < 16) {
+            level = (mrf.out >> (15 - mrf.bits)) & 1;
+        }
+    }
+
+    avr_raise_irq(miso_irq, level);
+}
+
+// IRO is low while the flag is up, the firmware takes the falling edge
+static void set_flag(uint8_t flag, uint8_t phase)
+{
+    if (flag && !mrf.flag) {
+        flag_up    = avr->cycle;
+        flag_phase = phase;
+        flag_saved = spi_saved;
+    }
+
+    mrf.flag = flag;
+    avr_raise_irq(iro_irq, !flag);
+    set_miso();
+}
+
+static void keep_worst(uint32_t *slot, avr_cycle_count_t cycles, int64_t saved)
+{
+    if (cycles > slot[0]) {
+        slot[0] = cycles;
+    }
+
+    int64_t hw = (int64_t)cycles - saved;
+    if (hw > slot[1]) {
+        slot[1] = hw;
+    }
+}
+
+// The flag came down, the byte has been dealt with
+static void serviced(void)
+{
+    keep_worst(worst[flag_phase].response, avr->cycle - flag_up,
+               spi_saved - flag_saved);
+    worst[flag_phase].count++;
+    isr_bytes++;
+}
+
+static uint16_t status(void)
+{
+    uint16_t value = 0;
+
+    if (mrf.flag) {
+        value |= MRF_TXRXFIFO;
+    }
+    if (mrf.overflow) {
+        value |= MRF_TXOWRXOF;
+    }
+    if (mrf.fifo_count == 0) {
+        value |= MRF_FIFOEM;
+    }
+    if (mrf.replaying) {
+        value |= MRF_ATTRSSI;
+    }
+
+    return value;
+}
+
+static uint8_t fifo_pop(void)
+{
+    if (mrf.fifo_count == 0) {
+        return 0;
+    }
+
+    uint8_t byte = mrf.fifo[0];
+    serviced();
+
+    // The flag stays up for the second byte, which is timed from when it
+    // came in
+    mrf.fifo[0]  = mrf.fifo[1];
+    flag_up      = mrf.fifo_time[1];
+    flag_saved   = mrf.fifo_saved[1];
+    flag_phase   = mrf.fifo_phase[1];
+    if (--mrf.fifo_count == 0) {
+        set_flag(0, 0);
+    }
+
+    return byte;
+}
+
+static void fifo_clear(void)
+{
+    mrf.synced     = 0;
+    mrf.shift      = 0;
+    mrf.fifo_count = 0;
+    if (!(mrf.txcen && mrf.txden)) {
+        set_flag(0, 0);
+    }
+}
+
+// The transmitter shifts out a byte every byte time
+static avr_cycle_count_t tx_clock(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    (void)avr;
+    (void)param;
+
+    if (!mrf.tx_full) {
+        underruns++;
+        return when + byte_cycles;
+    }
+
+    if (mrf.air_len < AIR_LEN) {
+        mrf.air[mrf.air_len++] = mrf.tx_byte;
+    }
+
+    if (--mrf.tx_full == 0) {
+        set_flag(1, PHASE_TX);
+    }
+
+    return when + byte_cycles;
+}
+
+// And the receiver takes one in every byte time, from the last burst sent
+static avr_cycle_count_t rx_clock(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    (void)avr;
+    (void)param;
+
+    if (mrf.air_pos == mrf.air_len) {
+        mrf.replaying = 0;
+        mrf.air_len   = 0;
+        return 0;
+    }
+
+    uint8_t byte = mrf.air[mrf.air_pos++];
+
+    if (!mrf.rxcen || !mrf.fifoen) {
+        return when + byte_cycles;
+    }
+
+    if (!mrf.synced) {
+        mrf.shift = (mrf.shift << 8) | byte;
+        if (mrf.fscf && mrf.shift == SYNC_WORD) {
+            mrf.synced   = 1;
+            mrf.rx_index = 0;
+            frames++;
+        }
+        return when + byte_cycles;
+    }
+
+    if (mrf.fifo_count == 2) {
+        overruns++;
+        mrf.overflow = 1;
+        return when + byte_cycles;
+    }
+
+    uint8_t phase = mrf.rx_index++ ? PHASE_RX : PHASE_RX_FIRST;
+    mrf.fifo[mrf.fifo_count]       = byte;
+    mrf.fifo_time[mrf.fifo_count]  = avr->cycle;
+    mrf.fifo_saved[mrf.fifo_count] = spi_saved;
+    mrf.fifo_phase[mrf.fifo_count] = phase;
+    mrf.fifo_count++;
+    set_flag(1, phase);
+
+    return when + byte_cycles;
+}
+
+static void tx_on(void)
+{
+    // The register's reset value, 0xAAAA, goes out first
+    mrf.air_len = 0;
+    mrf.tx_full = 2;
+    mrf.tx_byte = 0xAA;
+
+    // Receiving stops, whatever was coming in is lost
+    if (mrf.replaying) {
+        avr_cycle_timer_cancel(avr, rx_clock, NULL);
+        mrf.replaying = 0;
+    }
+    fifo_clear();
+
+    avr_cycle_timer_register(avr, byte_cycles, tx_clock, NULL);
+}
+
+static void tx_off(void)
+{
+    avr_cycle_timer_cancel(avr, tx_clock, NULL);
+    set_flag(0, 0);
+
+    // Play it back after a few byte times of quiet
+    if (mrf.air_len) {
+        mrf.air_pos   = 0;
+        mrf.replaying = 1;
+        avr_cycle_timer_register(avr, 4 * byte_cycles, rx_clock, NULL);
+    }
+}
+
+// A register write, at the end of the access
+static void command(uint16_t value)
+{
+    uint8_t transmitting = mrf.txcen && mrf.txden;
+
+    switch (value & 0xFF00) {
+        case MRF_PMCREG:
+            mrf.txcen = !!(value & MRF_TXCEN);
+            mrf.rxcen = !!(value & MRF_RXCEN);
+            break;
+
+        case MRF_GENCREG:
+            mrf.txden  = !!(value & MRF_TXDEN);
+            mrf.fifoen = !!(value & MRF_FIFOEN);
+            break;
+
+        case MRF_FIFORSTREG:
+            mrf.fscf = !!(value & MRF_FSCF);
+            if (!mrf.fscf) {
+                fifo_clear();
+            }
+            break;
+
+        case MRF_TXBREG:
+            if (transmitting && mrf.flag) {
+                mrf.tx_byte = value & 0xFF;
+                mrf.tx_full = 1;
+                serviced();
+                set_flag(0, 0);
+            }
+            break;
+
+        case MRF_DRSREG: {
+            uint32_t r  = (value & MRF_DRPV_MASK) + 1;
+            uint32_t cs = (value & MRF_DRPE) ? 8 : 1;
+
+            // BR = 10 MHz / 29 / (R + 1) / (1 + cs * 7)
+            byte_cycles = (uint64_t)8 * F_CPU * 29 * r * cs / 10000000;
+            break;
+        }
+    }
+
+    if (!transmitting && mrf.txcen && mrf.txden) {
+        tx_on();
+    } else if (transmitting && !(mrf.txcen && mrf.txden)) {
+        tx_off();
+    }
+}
+
+static void cs_changed(avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void)irq;
+    (void)param;
+
+    if (value == mrf.cs) {
+        return;
+    }
+    mrf.cs = value;
+
+    if (isr_active) {
+        if (!value && !isr_cs_first) {
+            isr_cs_first = avr->cycle;
+        } else if (value) {
+            isr_cs_last = avr->cycle;
+        }
+    }
+
+    if (!value) {
+        mrf.bits = 0;
+        mrf.in   = 0;
+        mrf.out  = status();
+    } else if (mrf.bits == 16) {
+        if (mrf.in == MRF_STSREG) {
+            mrf.overflow = 0;
+        } else {
+            command(mrf.in);
+        }
+    }
+
+    set_miso();
+}
+
+static void mosi_changed(avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void)irq;
+    (void)param;
+    mrf.mosi = value;
+}
+
+// MOSI is taken on the rising edge, MISO moves on the falling edge
+static void sck_changed(avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void)irq;
+    (void)param;
+
+    if (mrf.cs || mrf.bits >= 16) {
+        return;
+    }
+
+    if (value) {
+        if (mrf.bits == 0) {
+            sck_last = avr->cycle;
+        }
+        return;
+    }
+
+    mrf.in = (mrf.in << 1) | mrf.mosi;
+    mrf.bits++;
+
+    // The hardware's whole access is counted with the first bit, so an
+    // interval that ends part way through one is never short
+    spi_saved += (int64_t)(avr->cycle - sck_last);
+    if (mrf.bits == 1) {
+        spi_saved -= hw_spi_cycles;
+    }
+    sck_last = avr->cycle;
+
+    // A FIFO read has the data in the second byte
+    if (mrf.bits == 8 && (mrf.in & 0xFF) == (MRF_RXFIFOREG >> 8)) {
+        mrf.out = (mrf.out & 0xFF00) | fifo_pop();
+    }
+
+    set_miso();
+}
+
+static void isr_running(avr_irq_t *irq, uint32_t value, void *param)
+{
+    (void)irq;
+    (void)param;
+
+    if (value) {
+        isr_entry    = avr->cycle;
+        isr_saved    = spi_saved;
+        isr_phase    = flag_phase;
+        isr_bytes    = 0;
+        isr_active   = 1;
+        isr_cs_first = 0;
+
+        if (mrf.flag) {
+            keep_worst(worst_latency, avr->cycle - flag_up,
+                       spi_saved - flag_saved);
+        }
+        return;
+    }
+
+    isr_active = 0;
+
+    // The prologue up to the first CS edge, and the epilogue from the last
+    // one, are what the driver's isrCycles don't see
+    if (isr_cs_first) {
+        uint32_t cycles = (isr_cs_first - isr_entry) + (avr->cycle - isr_cs_last);
+        if (cycles > worst_entry_exit) {
+            worst_entry_exit = cycles;
+        }
+    }
+
+    // Each byte serviced has to fit in a byte time
+    uint32_t bytes = isr_bytes ? isr_bytes : 1;
+    keep_worst(worst[isr_phase].isr, (avr->cycle - isr_entry) / bytes,
+               (spi_saved - isr_saved) / bytes);
+}
+
+static void console_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    (void)avr;
+    (void)addr;
+    (void)param;
+
+    if (v != '\n' && line_len < sizeof(line) - 1) {
+        line[line_len++] = v;
+        return;
+    }
+
+    line[line_len] = 0;
+    line_len = 0;
+    printf("%s\n", line);
+
+    if (!strncmp(line, "lost", 4) || !strcmp(line, "FAILED")) {
+        bench_failed = 1;
+    } else if (!strcmp(line, "done")) {
+        bench_done = 1;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mrf_sim [-b bitrate] [-s cycles] [-x] bench.elf\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t bitrate = BITRATE;
+    int      banged  = 0;
+    int      c;
+
+    while ((c = getopt(argc, argv, "b:s:x")) != -1) {
+        switch (c) {
+            case 'b': bitrate       = atoi(optarg); break;
+            case 's': hw_spi_cycles = atoi(optarg); break;
+            case 'x': banged        = 1;            break;
+            default:  usage();
+        }
+    }
+
+    if (optind != argc - 1 || bitrate == 0) {
+        usage();
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware)) {
+        fprintf(stderr, "mrf_sim: can't read %s\n", argv[optind]);
+        return 2;
+    }
+
+    avr = avr_make_mcu_by_name("at90usb162");
+    if (!avr) {
+        fprintf(stderr, "mrf_sim: simavr has no at90usb162\n");
+        return 2;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = F_CPU;
+
+    // The power on DRSREG, 9579 bps
+    command(MRF_DRSREG | 35);
+    mrf.cs = 1;
+
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), CS_PIN),
+                            cs_changed, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), SCK_PIN),
+                            sck_changed, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), MOSI_PIN),
+                            mosi_changed, NULL);
+    miso_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), MISO_PIN);
+    iro_irq  = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), IRO_PIN);
+    avr_raise_irq(iro_irq, 1);
+
+    avr_irq_register_notify(avr_get_interrupt_irq(avr, IRO_VECTOR) + AVR_INT_IRQ_RUNNING,
+                            isr_running, NULL);
+    avr_register_io_write(avr, CONSOLE_ADDR, console_write, NULL);
+
+    int state = cpu_Running;
+    while (state != cpu_Done && state != cpu_Crashed &&
+           avr->cycle < (avr_cycle_count_t)SIM_SECONDS * F_CPU) {
+        state = avr_run(avr);
+    }
+
+    uint32_t limit = (uint64_t)8 * F_CPU / bitrate;
+    uint32_t worst_all[2] = { 0, 0 };
+
+    printf("\n%u frames received, %u overruns, %u underruns\n",
+           frames, overruns, underruns);
+    printf("Worst case cycles per byte        bit-banged   hardware SPI\n");
+    for (int p = 0; p < PHASES; p++) {
+        printf("  %-14s  interrupt  %10u  %13u\n", phase_names[p],
+               worst[p].isr[0], worst[p].isr[1]);
+        printf("  %-14s  response   %10u  %13u\n", "",
+               worst[p].response[0], worst[p].response[1]);
+
+        for (int i = 0; i < 2; i++) {
+            if (worst[p].isr[i] > worst_all[i]) {
+                worst_all[i] = worst[p].isr[i];
+            }
+            if (worst[p].response[i] > worst_all[i]) {
+                worst_all[i] = worst[p].response[i];
+            }
+        }
+    }
+
+    // What the board's isrCycles leave out, for isr_bench.py
+    printf("Worst latency %u cycles (%u bit-banged), entry and exit %u\n",
+           worst_latency[1], worst_latency[0], worst_entry_exit);
+
+    uint32_t worst_case = worst_all[banged ? 0 : 1];
+    printf("Byte time at %u bps: %u cycles, worst case %u (%s)\n",
+           bitrate, limit, worst_case, banged ? "bit-banged" : "hardware SPI");
+    if (worst_case) {
+        printf("Maximum sustainable bit rate: about %u bps\n",
+               (uint32_t)((uint64_t)8 * F_CPU / worst_case));
+    }
+
+    int failed = 0;
+    for (int p = 0; p < PHASES; p++) {
+        if (worst[p].count == 0) {
+            printf("FAIL: no %s bytes\n", phase_names[p]);
+            failed = 1;
+        }
+    }
+    if (!bench_done || bench_failed) {
+        printf("FAIL: the bench %s\n", bench_done ? "lost frames" : "didn't finish");
+        failed = 1;
+    }
+    if (overruns || underruns) {
+        printf("FAIL: bytes lost at %u cycles a byte\n", byte_cycles);
+        failed = 1;
+    }
+    if (worst_case > limit) {
+        printf("FAIL: over a byte time at %u bps\n", bitrate);
+        failed = 1;
+    }
+
+    return failed;
+}
@@ -0,0 +1,84 @@
+//
+//  link.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_link_h
+#define MRF49XA_Dongle_link_h
+
+#include <stdint.h>
+#include "MRF49XA.h"
+
+// Frames of PACKET_TYPE_LINK start with a link header byte, which says
+// what other headers follow it (in this order) before the data:
+//
+//   [link] [ARQ header, arq.h] [fragment header] [data] [score, adapt.h]
+//
+// A link frame's FEC bits are always set explicitly in the type byte, so
+// it doesn't matter that PACKET_TYPE_LINK has no _ECC version.
+#define LINK_HEADER_LEN     1
+#define LINK_ARQ            0x80    // ARQ header follows
+#define LINK_FRAG           0x40    // Fragment header follows
+#define LINK_AGG            0x20    // Data is records of other messages
+#define LINK_QUALITY        0x10    // Ends with a link quality score
+#define LINK_RATE           0x08    // Bit rate change handshake, rate.h
+#define LINK_BEACON         0x04    // TDMA beacon, tdma.h
+
+// Fragments of a message that doesn't fit in one frame.  The header is
+//
+//   id      Message number, the same in every fragment of a message
+//   offset  Where this fragment's data goes in the message (16 bits)
+//   length  Length of the whole message (16 bits)
+//
+// 16 bit values are sent low byte first.  Fragments are sent in order,
+// each as full as it will go.
+#define FRAG_HEADER_LEN     5
+
+// An aggregate's data is any number of records, each a length byte (never
+// 0) followed by that much data.  Each record is one message.
+
+// The link options word (LINKOPT in the register menu) is
+//   bits 15-12  ARQ retry timeout, in units of 16 ticks (0 is the default)
+//   bits 11-8   ARQ window size, 1 to 8 (0 is the default)
+//   bits 7-3    PACKET_FEC_* and PACKET_FLAG_*s to send with
+//   bits 2-1    Packet mode aggregation latency budget, 2^n ticks (0 is off)
+//   bit  0      Send packet mode frames with ARQ
+#define LINKOPT_ARQ         0x0001
+#define LINKOPT_PACKET_MASK 0x00F8
+
+// The second link options word (LINKOPT2) is
+//   bits 13-9   Whiten frames of PACKET_TYPE 1 to 5 (bit 8 + type)
+//   bit  7      Listen before talk (CSMA)
+//   bit  6      Agree on the packet mode bit rate with the other side
+//   bit  5      Choose the packet mode coding from the other side's reports
+//   bit  4      Send and expect hamming coded frame headers
+//   bits 3-1    Interleaver depth, 2 to 7 (0 or 1 is MRF_INTERLEAVE_DEFAULT),
+//               Reed-Solomon frames are sent without interleaving whatever
+//               the flag says, see MRF_INTERLEAVE_MAX
+//   bit  0      Pass bytes hamming couldn't correct on as MRF_ERASURE_MARK
+#define LINKOPT2_MARK_ERASURES  0x0001
+#define LINKOPT2_CODED_HEADER   0x0010
+#define LINKOPT2_ADAPT_FEC      0x0020
+#define LINKOPT2_ADAPT_RATE     0x0040
+#define LINKOPT2_CSMA           0x0080
+#define LINKOPT2_INTERLEAVE(opt)    (((opt) >> 1) & 0x07)
+#define LINKOPT2_WHITEN_TYPES(opt)  (((opt) >> 8) & 0x3E)
+
+// ARQ (arq.h), the adaptive coding (adapt.h), bit rate (rate.h) and time
+// slots (tdma.h) can each be left out of the build with LINK_NO_ARQ,
+// LINK_NO_ADAPT, LINK_NO_RATE and LINK_NO_TDMA, for the RAM.  Their options
+// are then ignored.  The bit rate steps on the adaptive coding's score, so
+// it goes too.  The adaptive coding goes by the driver's counters, so it
+// needs those (see MRF_NO_STATS).
+#if defined(MRF_NO_STATS) && !defined(LINK_NO_ADAPT)
+#define LINK_NO_ADAPT
+#endif
+
+#if defined(LINK_NO_ADAPT) && !defined(LINK_NO_RATE)
+#define LINK_NO_RATE
+#endif
+
+#endif
@@ -36,6 +36,7 @@
 #include "Descriptors.h"
 #include "registers.h"
 #include "packet.h"
+#include "tdma.h"
 #include "serial.h"
 #include "usbSerial.h"
 
@@ -100,13 +101,16 @@ ISR(TIMER0_OVF_vect, ISR_NOBLOCK)
     // which will overflow once every 536 seconds, or 8.94 minutes.
     ticks++;
     
+    // Drop any received frame that has stalled
+    MRF_tick();
+    
+    // Open the transmitter in our time slot
+    tdmaTick();
+    
     CDC_Device_USBTask(&CDC_interface);
     USB_USBTask();
 }
 
-// This is the "file" representing the USB stream
-// it is non-blocking, so line-based io is unlikely to work as expected.
-static FILE USB_USART;
 bool configured;
 
 // Basic callbacks for USB events.
@@ -191,9 +195,6 @@ init(void) {
     // this should be sufficient for the 30 mS rate required by USB (actual is 8mS).
     TIMSK0 = 0x01; // Enable the overflow timer interrupt
     
-    // Create the CDC serial stream device
-    CDC_Device_CreateStream(&CDC_interface, &USB_USART);
-    
     // Setup the internal UART
     // Setup the DDRD for RXD and TXD
     DDRD &= ~(1 << 2);
@@ -219,6 +220,7 @@ const uint8_t typeSerialString[]    PROGMEM = "\n\rSerial, ";
 const uint8_t typeSerialECCString[] PROGMEM = "\n\rSerial ECC, ";
 const uint8_t typePacketString[]    PROGMEM = "\n\rPacket, ";
 const uint8_t typePacketECCString[] PROGMEM = "\n\rPacket ECC, ";
+const uint8_t typeLinkString[]      PROGMEM = "\n\rLink, ";
 const uint8_t typeUnknownString[]   PROGMEM = "\n\rUnknown type, ";
 const uint8_t packetLengthString[]  PROGMEM = "length ";
 const uint8_t invalidModeString[]   PROGMEM = " Invalid mode, ";
@@ -226,7 +228,7 @@ const uint8_t invalidModeString[]   PROGMEM = " Invalid mode, ";
 void printPacket(MRF_packet_t *rx_packet)
 {
     // Print a label for the packet type
-    switch (rx_packet->type) {
+    switch (rx_packet->type & PACKET_TYPE_MASK) {
         case PACKET_TYPE_SERIAL:
             sendStringP(typeSerialString);
             break;
@@ -239,6 +241,9 @@ void printPacket(MRF_packet_t *rx_packet)
         case PACKET_TYPE_PACKET_ECC:
             sendStringP(typePacketECCString);
             break;
+        case PACKET_TYPE_LINK:
+            sendStringP(typeLinkString);
+            break;
         default:
             sendStringP(typeUnknownString);
             break;
@@ -277,6 +282,7 @@ void printPacket(MRF_packet_t *rx_packet)
 
 int main(void) {
     uint8_t byte;
+    uint8_t inPacketMode = false;
     
     // Initalize the system
     init();
@@ -291,6 +297,16 @@ int main(void) {
     // Loop here forever
     while (true) {
         
+        // The packet modes have link layer work to start and stop
+        if ((mode == PACKET || mode == PACKET_ECC) != inPacketMode) {
+            inPacketMode = !inPacketMode;
+            if (inPacketMode) {
+                packetStart();
+            } else {
+                packetStop();
+            }
+        }
+        
         // Process menu actions as long as we're in the menu or test modes
         // New packets received while in menu mode are ignored
         if (mode == MENU      ||
@@ -12,6 +12,11 @@
 #include "utilities.h"
 #include "registers.h"
 #include "MRF49XA.h"
+#include "arq.h"
+#include "adapt.h"
+#include "rate.h"
+#include "tdma.h"
+#include "packet.h"
 #include <LUFA/Drivers/USB/Class/Device/CDC.h>
 #include <LUFA/Drivers/USB/USB.h>
 
@@ -60,7 +65,9 @@ MRF49XA Dongle test menu\n\r\
 2) TX ones\n\r\
 3) TX zeros\n\r\n\r\
 4) Echo received packets\n\r\
-5) Print received packets\n\r\n\r\
+5) Print received packets\n\r\
+6) Print link statistics\n\r\
+7) Time an SPI register write\n\r\n\r\
 x) Stop function and exit\n\r\
 ?) Print this menu\n\r\
 > ";
@@ -77,11 +84,153 @@ const uint8_t newLineString[]   PROGMEM = "\n\r";
 const uint8_t invalidString[]   PROGMEM = "\n\rInvalid input ";
 const uint8_t transmittingString[] PROGMEM = "\n\rTRANSMITTING!\n\r";
 
+const uint8_t rxOverflowString[]   PROGMEM = "\n\rRX ring overflows:  ";
+const uint8_t rxTimeoutString[]    PROGMEM = "\n\rRX timeouts:        ";
+const uint8_t rxCrcErrorString[]   PROGMEM = "\n\rRX CRC errors:      ";
+const uint8_t rxFecFixedString[]   PROGMEM = "\n\rRX FEC corrections: ";
+const uint8_t rxFecErasedString[]  PROGMEM = "\n\rRX FEC erasures:    ";
+const uint8_t rxFecFailedString[]  PROGMEM = "\n\rRX FEC failures:    ";
+const uint8_t rxHeaderErrorString[] PROGMEM = "\n\rRX header errors:   ";
+const uint8_t rxHighWaterString[]  PROGMEM = "\n\rRX ring high water: ";
+const uint8_t spiCyclesString[]    PROGMEM = "\n\rCPU cycles per register write: ";
+const uint8_t txCompleteString[]   PROGMEM = "\n\rTX packets sent:    ";
+const uint8_t txChainedString[]    PROGMEM = "\n\rTX packets chained: ";
+const uint8_t csmaBusyString[]     PROGMEM = "\n\rCSMA backoffs:      ";
+const uint8_t csmaForcedString[]   PROGMEM = "\n\rCSMA sent anyway:   ";
+const uint8_t spiDeferredString[]  PROGMEM = "\n\rIRO deferred:      ";
+const uint8_t isrBytesString[]     PROGMEM = "\n\rIRO interrupts by bytes serviced (0 to n): ";
+const uint8_t isrCyclesString[]    PROGMEM = "\n\rISR worst case cycles (idle, tx, rx, header): ";
+const uint8_t regSkippedString[]   PROGMEM = "\n\rRegister writes skipped: ";
+const uint8_t arqRetransmitString[] PROGMEM = "\n\rARQ retransmits:    ";
+const uint8_t arqGiveUpString[]     PROGMEM = "\n\rARQ frames given up: ";
+const uint8_t arqDuplicateString[]  PROGMEM = "\n\rARQ duplicates:     ";
+const uint8_t arqSkippedString[]    PROGMEM = "\n\rARQ frames skipped: ";
+const uint8_t fragAbortString[]     PROGMEM = "\n\rLong messages cut short: ";
+const uint8_t adaptLevelString[]    PROGMEM = "\n\rFEC level, our score, their score: ";
+const uint8_t adaptSwitchString[]   PROGMEM = "\n\rFEC level changes:  ";
+const uint8_t adaptLogString[]      PROGMEM = "\n\rLast changes (tick level score): ";
+const uint8_t rateLevelString[]     PROGMEM = "\n\rBit rate level, changes, fallbacks: ";
+const uint8_t tdmaSlotString[]      PROGMEM = "\n\rTDMA slot, in step: ";
+const uint8_t tdmaBeaconString[]    PROGMEM = "\n\rTDMA beacons sent, heard: ";
+
 enum menu_item menuTopHandleByte(uint8_t byte);
 enum menu_item menuEditHandleByte(uint8_t byte);
 enum menu_item menuTestHandleByte(uint8_t byte);
 enum menu_item menuBootHandleByte(uint8_t byte);
 
+// The driver's counters and the link layer's are printed separately, so
+// that their copies aren't on the stack at the same time.  The driver's
+// can be left out of the build (MRF_NO_STATS).
+static void printDriverStats(void)
+{
+#ifndef MRF_NO_STATS
+    MRF_stats_t stats;
+    MRF_get_stats(&stats);
+    
+    sendStringP(rxOverflowString);
+    print_dec(stats.rxOverflow);
+    sendStringP(rxTimeoutString);
+    print_dec(stats.rxTimeout);
+    sendStringP(rxCrcErrorString);
+    print_dec(stats.rxCrcError);
+    sendStringP(rxFecFixedString);
+    print_dec(stats.rxFecCorrected);
+    sendStringP(rxFecErasedString);
+    print_dec(stats.rxFecErased);
+    sendStringP(rxFecFailedString);
+    print_dec(stats.rxFecFailed);
+    sendStringP(rxHeaderErrorString);
+    print_dec(stats.rxHeaderError);
+    sendStringP(rxHighWaterString);
+    print_dec(stats.rxHighWater);
+    sendStringP(txCompleteString);
+    print_dec(stats.txComplete);
+    sendStringP(txChainedString);
+    print_dec(stats.txChained);
+    sendStringP(csmaBusyString);
+    print_dec(stats.csmaBusy);
+    sendStringP(csmaForcedString);
+    print_dec(stats.csmaForced);
+    sendStringP(spiDeferredString);
+    print_dec(stats.spiDeferred);
+    sendStringP(regSkippedString);
+    print_dec(stats.regWritesSkipped);
+    sendStringP(isrBytesString);
+    for (uint8_t i = 0; i <= MRF_ISR_MAX_BYTES; i++) {
+        print_dec(stats.isrBytes[i]);
+        CDC_Device_SendByte(&CDC_interface, ' ');
+    }
+    sendStringP(isrCyclesString);
+    for (uint8_t i = 0; i < MRF_ISR_STATES; i++) {
+        print_dec(stats.isrCycles[i]);
+        CDC_Device_SendByte(&CDC_interface, ' ');
+    }
+#endif
+}
+
+void printLinkStats(void)
+{
+    ARQ_stats_t arq;
+    ADAPT_stats_t adapt;
+    RATE_stats_t rate;
+    TDMA_stats_t tdma;
+    
+    printDriverStats();
+    
+    arqGetStats(&arq);
+    adaptGetStats(&adapt);
+    rateGetStats(&rate);
+    tdmaGetStats(&tdma);
+    
+    sendStringP(arqRetransmitString);
+    print_dec(arq.retransmits);
+    sendStringP(arqGiveUpString);
+    print_dec(arq.giveUps);
+    sendStringP(arqDuplicateString);
+    print_dec(arq.duplicates);
+    sendStringP(arqSkippedString);
+    print_dec(arq.skipped);
+    sendStringP(fragAbortString);
+    print_dec(packetMessagesAborted());
+    sendStringP(adaptLevelString);
+    print_dec(adapt.level);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(adapt.score);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(adapt.peer);
+    sendStringP(adaptSwitchString);
+    print_dec(adapt.switches);
+    sendStringP(adaptLogString);
+    for (uint8_t i = 0; i < ADAPT_LOG_LEN; i++) {
+        if (ADAPT_LOG_LEN - i > adapt.switches) {
+            continue;
+        }
+        
+        sendStringP(newLineString);
+        print_dec(adapt.log[i].tick);
+        CDC_Device_SendByte(&CDC_interface, ' ');
+        print_dec(adapt.log[i].level);
+        CDC_Device_SendByte(&CDC_interface, ' ');
+        print_dec(adapt.log[i].report);
+    }
+    sendStringP(rateLevelString);
+    print_dec(rate.level);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(rate.changes);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(rate.fallbacks);
+    sendStringP(tdmaSlotString);
+    print_dec(tdma.slot);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(tdma.synced);
+    sendStringP(tdmaBeaconString);
+    print_dec(tdma.beaconsSent);
+    CDC_Device_SendByte(&CDC_interface, ' ');
+    print_dec(tdma.beaconsHeard);
+    sendStringP(newLineString);
+    CDC_Device_Flush(&CDC_interface);
+}
+
 #pragma mark Menu logic
 void menuHandleByte(uint8_t byte)
 {
@@ -243,12 +392,17 @@ Existing register contents:
     if(index < 0) {
         CDC_Device_SendByte(&CDC_interface, byte);
 
-        if(byte < '0' || byte > '9') {
-            return MENU_TOP;
-        } else {
+        // Registers past 9 are lettered
+        if(byte >= '0' && byte <= '9') {
             index = byte - '0';
-            sendStringP(editValuePromptString);
+        } else if((byte | 0x20) == 'a') {
+            index = 10;
+        } else if((byte | 0x20) == 'b') {
+            index = 11;
+        } else {
+            return MENU_TOP;
         }
+        sendStringP(editValuePromptString);
         
         return MENU_EDIT;
     }
@@ -296,7 +450,8 @@ enum menu_item menuTestHandleByte(uint8_t byte)
 3) Transmit zeros
 4) Echo received packets
 5) Print received packets
-6) Reset the transciever (stop transmitting)
+6) Print link statistics
+7) Time an SPI register write
 x) Exit this menu (will stop testing function)
 ?) Print this menu
 */
@@ -336,6 +491,19 @@ x) Exit this menu (will stop testing function)
             mode = CAPTURE;
             break;
 
+        case '6':
+            CDC_Device_SendByte(&CDC_interface, byte);
+            printLinkStats();
+            break;
+
+        case '7':
+            CDC_Device_SendByte(&CDC_interface, byte);
+            sendStringP(spiCyclesString);
+            print_dec(MRF_spi_cycles());
+            sendStringP(newLineString);
+            CDC_Device_Flush(&CDC_interface);
+            break;
+
         case 'x':
             sendStringP(newLineString);
             CDC_Device_Flush(&CDC_interface);
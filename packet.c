@@ -9,16 +9,158 @@
 #include "packet.h"
 #include "modes.h"
 #include "MRF49XA.h"
+#include "link.h"
+#include "arq.h"
+#include "adapt.h"
+#include "rate.h"
+#include "tdma.h"
 #include "utilities.h"
 #include <LUFA/Drivers/USB/Class/Device/CDC.h>
 #include <LUFA/Drivers/USB/USB.h>
 
+// Every header a packet can have has to leave room for some data
+#if MRF_PAYLOAD_LEN <= LINK_HEADER_LEN + ARQ_HEADER_LEN + FRAG_HEADER_LEN + ADAPT_REPORT_LEN
+#error MRF_PAYLOAD_LEN is too small for the packet mode headers
+#endif
+
 extern USB_ClassInfo_CDC_Device_t CDC_interface;
 extern volatile enum device_mode mode;
 
-extern volatile uint8_t counter;
 extern volatile MRF_packet_t packet;
 
+// Messages from the host are a length byte, a type byte and the payload.
+// Messages that won't fit in one frame start with PACKET_LENGTH_LONG
+// instead, followed by the 16 bit length (low byte first).  Those are sent
+// as fragments, and are passed to the host on the other side the same way,
+// with a status byte on the end (PACKET_STATUS_*).
+//
+// There's no room to put a long message back together in RAM, so the
+// fragments are passed on to the host as they arrive, in order.  If one
+// goes missing, or the rest of the message doesn't arrive in time, the
+// host gets zeros for the rest of the message and an incomplete status.
+// Anything else arriving first means the rest isn't coming either, see
+// packet.h for what the host has to do.
+//
+// With aggregation on, short messages are packed into one frame as
+// records (a length byte and the data) until the frame is full or the
+// first of them has waited the latency budget, so small messages don't
+// each pay for a preamble, sync and the transmitter turning on.  They're
+// passed to the host on the other side as separate messages again.
+enum packet_host_state {
+    HOST_LENGTH,
+    HOST_LENGTH_LOW,
+    HOST_LENGTH_HIGH,
+    HOST_TYPE,
+    HOST_DATA
+};
+
+static enum packet_host_state hostState;
+static uint16_t msgLength;      // Length of the message from the host
+static uint16_t msgOffset;      // Bytes of it read so far
+static uint8_t  msgLong;        // It's being sent as fragments
+static uint8_t  msgAggregate;   // It's being packed in with others
+static uint8_t  msgId;          // Number of the message being sent
+static uint8_t  dataStart;      // Where the data goes in the packet
+static uint8_t  dataCount;      // Data in the packet so far
+static uint8_t  frameLong;      // The packet is a fragment
+static uint8_t  frameAggregate; // The packet is an aggregate, still open
+
+// Aggregation latency budget in ticks, 0 if it's off
+static uint8_t  aggLatency;
+static uint16_t aggDeadline;
+
+// Set when a complete packet is waiting for room in the transmit queue
+static uint8_t packetPending;
+
+// The long message being passed on to the host
+static uint8_t  rxMsgActive;
+static uint8_t  rxMsgId;
+static uint16_t rxMsgLength;
+static uint16_t rxMsgOffset;
+static uint16_t rxMsgDeadline;
+static uint16_t rxMsgAborted;
+
+static uint8_t hostHeaderLength(void)
+{
+    uint8_t length = 0;
+
+    if (arqEnabled() || msgLong || msgAggregate || adaptEnabled()) {
+        length += LINK_HEADER_LEN;
+    }
+
+    if (arqEnabled()) {
+        length += ARQ_HEADER_LEN;
+    }
+
+    if (msgLong) {
+        length += FRAG_HEADER_LEN;
+    }
+
+    return length;
+}
+
+// Payload that headers and data can use, the link quality score goes last
+static uint8_t hostPayloadRoom(void)
+{
+    return MRF_PAYLOAD_LEN - (adaptEnabled() ? ADAPT_REPORT_LEN : 0);
+}
+
+// Set up the headers of the next packet of the message
+static void hostPacketStart(void)
+{
+    uint8_t ecc = (mode == PACKET_ECC);
+
+    dataStart = hostHeaderLength();
+    dataCount = 0;
+    frameLong = msgLong;
+    frameAggregate = msgAggregate;
+
+    // Plain packets are sent the way they always have been
+    if (dataStart == 0) {
+        packet.type = ecc ? PACKET_TYPE_PACKET_ECC : PACKET_TYPE_PACKET;
+        return;
+    }
+
+    packet.type = PACKET_TYPE_LINK | (ecc ? PACKET_FEC_HAMMING : PACKET_FEC_DEFAULT);
+    packet.payload[0] = msgLong ? LINK_FRAG : (msgAggregate ? LINK_AGG : 0);
+}
+
+// Start a record in the aggregate, or a new aggregate
+static void hostRecordStart(void)
+{
+    if (!frameAggregate) {
+        hostPacketStart();
+        aggDeadline = getTicks() + aggLatency;
+    }
+
+    packet.payload[dataStart + dataCount] = msgLength;
+    dataCount++;
+}
+
+// The packet is as full as it's going to get, fill in the fragment header
+static void hostPacketDone(void)
+{
+    packet.payloadSize = dataStart + dataCount;
+    frameAggregate = 0;
+
+    if (frameLong) {
+        uint8_t *header = (uint8_t *)&packet.payload[dataStart - FRAG_HEADER_LEN];
+        uint16_t offset = msgOffset - dataCount;
+
+        header[0] = msgId;
+        header[1] = offset & 0xFF;
+        header[2] = offset >> 8;
+        header[3] = msgLength & 0xFF;
+        header[4] = msgLength >> 8;
+    }
+
+    if (dataStart != 0) {
+        adaptTag((MRF_packet_t *)&packet);
+    }
+
+    packetPending = 1;
+}
+
 void packetBreakReceived()
 {
     return;
@@ -26,45 +168,312 @@ void packetBreakReceived()
 
 void packetByteReceived(uint8_t byte)
 {
-    // Fill out the packet contents
-    switch (counter) {
-            
-        case 0:
-            // Sanity checking on the length byte
-            if (byte <= MRF_PAYLOAD_LEN) {
-                packet.payloadSize = byte;
-                counter++;
+    switch (hostState) {
+
+        case HOST_LENGTH:
+            msgLong = 0;
+            msgAggregate = 0;
+            if (byte == PACKET_LENGTH_LONG) {
+                hostState = HOST_LENGTH_LOW;
+                break;
             }
+
+            // Sanity checking on the length byte (aggregates need room for
+            // the record length too)
+            msgAggregate = (aggLatency != 0);
+            if (byte > 0 && byte <= hostPayloadRoom() - hostHeaderLength() - msgAggregate) {
+                msgLength = byte;
+                hostState = HOST_TYPE;
+            }
+            break;
+
+        case HOST_LENGTH_LOW:
+            msgLength = byte;
+            hostState = HOST_LENGTH_HIGH;
             break;
-            
-        case 1:
-            
-            if (mode == SERIAL_ECC) {
-                packet.type = PACKET_TYPE_SERIAL_ECC;
+
+        case HOST_LENGTH_HIGH:
+            msgLength |= (uint16_t)byte << 8;
+            msgLong    = 1;
+            msgId++;
+            hostState  = (msgLength > 0) ? HOST_TYPE : HOST_LENGTH;
+            break;
+
+        case HOST_TYPE:
+            // The type comes from the mode
+            msgOffset = 0;
+            hostState = HOST_DATA;
+
+            // If it won't go in the open aggregate, send that first.  This
+            // message is started once it's been queued.
+            if (frameAggregate &&
+                (!msgAggregate || dataStart + dataCount + 1 + msgLength > hostPayloadRoom())) {
+                hostPacketDone();
+                break;
+            }
+
+            if (msgAggregate) {
+                hostRecordStart();
             } else {
-                packet.type = PACKET_TYPE_SERIAL;
+                hostPacketStart();
             }
-            
-            counter++;
             break;
-            
-        default:
-            packet.payload[counter - 2] = byte;
-            counter++;
+
+        case HOST_DATA:
+            packet.payload[dataStart + dataCount] = byte;
+            dataCount++;
+            msgOffset++;
+
+            // Aggregates stay open for the next message, unless there isn't
+            // room for one more byte of data
+            if (frameAggregate) {
+                if (msgOffset == msgLength) {
+                    hostState = HOST_LENGTH;
+                    if (dataStart + dataCount + 2 > hostPayloadRoom()) {
+                        hostPacketDone();
+                    }
+                }
+            } else if (msgOffset == msgLength || dataStart + dataCount == hostPayloadRoom()) {
+                hostPacketDone();
+            }
             break;
     }
-    
-    // If the counter equals the packet size, transmit
-    if (counter >= packet.payloadSize + MRF_PACKET_OVERHEAD) {
-        // Disable new serial data during this routine
-        MRF_transmit_packet(&packet);
-        counter = 0;
+}
+
+// Which type the host is told a packet was
+static uint8_t hostType(uint8_t type)
+{
+    if ((type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK) {
+        return type & PACKET_TYPE_MASK;
+    }
+
+    return PACKET_IS_HAMMING(type) ? PACKET_TYPE_PACKET_ECC : PACKET_TYPE_PACKET;
+}
+
+// Give up on the long message going to the host
+static void hostMessageAbort(void)
+{
+    while (rxMsgOffset < rxMsgLength) {
+        CDC_Device_SendByte(&CDC_interface, 0);
+        rxMsgOffset++;
+    }
+
+    CDC_Device_SendByte(&CDC_interface, PACKET_STATUS_INCOMPLETE);
+    rxMsgActive = 0;
+    rxMsgAborted++;
+}
+
+// A fragment of a long message from the radio
+static void hostFragment(MRF_packet_t *rx_packet)
+{
+    if (rx_packet->payloadSize < LINK_HEADER_LEN + FRAG_HEADER_LEN) {
+        return;
+    }
+
+    uint8_t *header = &rx_packet->payload[LINK_HEADER_LEN];
+    uint8_t *data   = header + FRAG_HEADER_LEN;
+    uint8_t  count  = rx_packet->payloadSize - LINK_HEADER_LEN - FRAG_HEADER_LEN;
+    uint16_t offset = header[1] | ((uint16_t)header[2] << 8);
+    uint16_t length = header[3] | ((uint16_t)header[4] << 8);
+
+    if (offset + count > length) {
+        return;
+    }
+
+    // The start of a different message means the last one isn't coming
+    if (rxMsgActive && (header[0] != rxMsgId || length != rxMsgLength)) {
+        hostMessageAbort();
+    }
+
+    if (!rxMsgActive) {
+        if (offset != 0) {
+            return;
+        }
+
+        rxMsgActive = 1;
+        rxMsgId     = header[0];
+        rxMsgLength = length;
+        rxMsgOffset = 0;
+
+        CDC_Device_SendByte(&CDC_interface, PACKET_LENGTH_LONG);
+        CDC_Device_SendByte(&CDC_interface, length & 0xFF);
+        CDC_Device_SendByte(&CDC_interface, length >> 8);
+        CDC_Device_SendByte(&CDC_interface, hostType(rx_packet->type));
+    }
+
+    // Already passed on
+    if (offset < rxMsgOffset) {
+        return;
+    }
+
+    // Something's missing
+    if (offset > rxMsgOffset) {
+        hostMessageAbort();
+        return;
+    }
+
+    CDC_Device_SendData(&CDC_interface, data, count);
+    rxMsgOffset  += count;
+    rxMsgDeadline = getTicks() + PACKET_FRAGMENT_TIMEOUT;
+
+    if (rxMsgOffset == rxMsgLength) {
+        CDC_Device_SendByte(&CDC_interface, PACKET_STATUS_COMPLETE);
+        rxMsgActive = 0;
     }
+}
+
+// Each record of an aggregate goes to the host as its own message
+static void hostAggregate(MRF_packet_t *rx_packet)
+{
+    uint8_t i = LINK_HEADER_LEN;
+    uint8_t type = hostType(rx_packet->type);
+
+    while (i < rx_packet->payloadSize) {
+        uint8_t count = rx_packet->payload[i++];
+        if (count == 0 || i + count > rx_packet->payloadSize) {
+            return;
+        }
 
+        CDC_Device_SendByte(&CDC_interface, count);
+        CDC_Device_SendByte(&CDC_interface, type);
+        CDC_Device_SendData(&CDC_interface, &rx_packet->payload[i], count);
+        i += count;
+    }
+}
+
+// Received packets go to the host framed the same way as they come from it
+static void packetSendToHost(MRF_packet_t *rx_packet)
+{
+    uint8_t *data  = rx_packet->payload;
+    uint8_t  count = rx_packet->payloadSize;
+    uint8_t  link  = (rx_packet->type & PACKET_TYPE_MASK) == PACKET_TYPE_LINK;
+
+    if (link) {
+        if (count < LINK_HEADER_LEN) {
+            return;
+        }
+
+        if (data[0] == LINK_FRAG) {
+            hostFragment(rx_packet);
+            return;
+        }
+
+        // Anything else we don't understand
+        if (data[0] != LINK_AGG && data[0] != 0) {
+            return;
+        }
+    }
+
+    // It can't go in the middle of a long message to the host
+    if (rxMsgActive) {
+        hostMessageAbort();
+    }
+
+    if (link) {
+        if (data[0] == LINK_AGG) {
+            hostAggregate(rx_packet);
+            return;
+        }
+
+        data  += LINK_HEADER_LEN;
+        count -= LINK_HEADER_LEN;
+    }
+
+    CDC_Device_SendByte(&CDC_interface, count);
+    CDC_Device_SendByte(&CDC_interface, hostType(rx_packet->type));
+    CDC_Device_SendData(&CDC_interface, data, count);
+}
+
+uint16_t packetMessagesAborted(void)
+{
+    return rxMsgAborted;
+}
+
+void packetConfigure(uint16_t linkopt)
+{
+    uint8_t aggregate = PACKET_LINKOPT_AGGREGATE(linkopt);
+    aggLatency = aggregate ? (1 << aggregate) : 0;
+}
+
+// The link layer only runs in the packet modes.  Nothing else handles
+// beacons or rate frames, so the time slots stop with them, and the bit
+// rate goes back to the saved one.  Frames waiting for an acknowledgement
+// are given up on, they'd hold on to transmit buffer space.
+void packetStart(void)
+{
+    tdmaStart();
+}
+
+void packetStop(void)
+{
+    // The host has moved on, so the zeros would just be in the way
+    if (rxMsgActive) {
+        rxMsgActive = 0;
+        rxMsgAborted++;
+    }
+
+    arqStop();
+    rateStop();
+    tdmaStop();
 }
 
 void packetMainLoop(void)
 {
+    // Retries and acknowledgements (the other side may be using ARQ even
+    // if we aren't)
+    arqPoll();
+    ratePoll();
+    tdmaPoll();
+
+    // Handle new packets from the radio
+    MRF_packet_t *rx_packet = arqReceive();
+
+    // The other side gave up on the next fragment of the long message
+    if (arqSkipped() && rxMsgActive) {
+        hostMessageAbort();
+    }
+
+    if (rx_packet) {
+        packetSendToHost(rx_packet);
+    }
+
+    // The rest of a long message has taken too long
+    if (rxMsgActive && (int16_t)(getTicks() - rxMsgDeadline) >= 0) {
+        hostMessageAbort();
+    }
+
+    // The oldest message in the aggregate has waited long enough
+    if (frameAggregate && !packetPending && hostState == HOST_LENGTH &&
+        (int16_t)(getTicks() - aggDeadline) >= 0) {
+        hostPacketDone();
+    }
+
+    // Try to queue a finished packet, new bytes have to wait until it's in
+    if (packetPending) {
+        uint8_t queued;
+        if (arqEnabled()) {
+            queued = arqSend((MRF_packet_t *)&packet);
+        } else {
+            queued = MRF_transmit_packet((MRF_packet_t *)&packet);
+        }
+
+        if (queued) {
+            packetPending = 0;
+
+            // The next fragment, the message that didn't fit in the last
+            // aggregate, or the next message
+            if (hostState != HOST_DATA || msgOffset == msgLength) {
+                hostState = HOST_LENGTH;
+            } else if (msgAggregate) {
+                hostRecordStart();
+            } else {
+                hostPacketStart();
+            }
+        }
+
+        return;
+    }
+
     // Handle new bytes from USB
     if (CDC_Device_BytesReceived(&CDC_interface) > 0) {
         packetByteReceived(CDC_Device_ReceiveByte(&CDC_interface));
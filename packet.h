@@ -9,7 +9,37 @@
 #ifndef MRF49XA_Dongle_packet_h
 #define MRF49XA_Dongle_packet_h
 
+#include <stdint.h>
+
+// Framing of long messages to and from the host, see packet.c
+#define PACKET_LENGTH_LONG          0xFF
+#define PACKET_STATUS_COMPLETE      0x00
+#define PACKET_STATUS_INCOMPLETE    0x01
+
+// A long message to the host is PACKET_LENGTH_LONG, the 16 bit length (low
+// byte first), the type, exactly that many bytes and a status byte.  The
+// bytes are passed on as the fragments arrive, because there's no RAM to
+// hold the message back until it's whole.  So:
+//   - nothing else is sent to the host between the header and the status
+//   - with PACKET_STATUS_INCOMPLETE some of the bytes are zeros standing
+//     in for fragments that never came, and the whole message should be
+//     thrown away
+//   - leaving packet mode in the middle of one just stops, with no status
+
+// Ticks to wait for the next fragment of a long message, about 2 seconds
+#define PACKET_FRAGMENT_TIMEOUT     244
+
+// Aggregation latency budget from the link options (link.h), 2^n ticks
+#define PACKET_LINKOPT_AGGREGATE(opt)   (((opt) >> 1) & 0x03)
+
 void packetMainLoop(void);
 void packetBreakReceived(void);
 
+// Entering and leaving the packet modes, see main()
+void packetStart(void);
+void packetStop(void);
+
+uint16_t packetMessagesAborted(void);
+void     packetConfigure(uint16_t linkopt);
+
 #endif
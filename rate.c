@@ -0,0 +1,415 @@
+//
+//  rate.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#include <string.h>
+#include "rate.h"
+#include "adapt.h"
+#include "utilities.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(value) *value
+#define pgm_read_word(value) *value
+#endif
+
+#ifndef LINK_NO_RATE
+
+// The levels above 0, slowest first.  The receive bandwidth covers the
+// deviation on either side plus half the bit rate.  Level 0 is whatever
+// the saved registers set up, see rateConfigure().
+typedef struct {
+    uint16_t drsreg;
+    uint8_t  rxbw;
+    uint8_t  modbw;
+} rate_entry_t;
+
+#define RATE_LEVELS 3
+
+// The top level is the rate "make isr-bench" checks the IRO interrupt
+// against (BITRATE in isr-bench/mrf_sim.c), keep the two the same
+static const rate_entry_t rate_table[RATE_LEVELS - 1] PROGMEM = {
+    { MRF_DRSREG | 17, MRF_RXBW_134K, MRF_MODBW_45K },  // 19157 bps
+    { MRF_DRSREG |  8, MRF_RXBW_200K, MRF_MODBW_60K },  // 38314 bps
+};
+
+enum rate_state {
+    RATE_IDLE,
+    RATE_REQUESTING,    // Waiting for an ACCEPT
+    RATE_ACCEPTING,     // Waiting for our ACCEPT to go
+    RATE_PROBATION      // Switched, waiting for a CONFIRM
+};
+
+#define RATE_NONE   0xFF
+
+static uint8_t  rate_enabled;
+static enum rate_state rate_state;
+static uint8_t  rate_pending = RATE_NONE;   // Level to switch to when the radio is free
+static uint8_t  rate_new;       // Level being changed to
+static uint8_t  rate_old;       // And the one to go back to
+static uint8_t  rate_asked;     // We sent the REQUEST
+static uint8_t  rate_confirmed; // Our CONFIRM has been queued
+static uint8_t  rate_frame;     // Handle of our ACCEPT
+static uint8_t  rate_nonce;     // Settles two REQUESTs crossing
+static uint16_t rate_deadline;
+static uint16_t rate_changed;   // When the level last changed (or we tried)
+static uint16_t rate_heard;     // When we last heard the other side
+static uint16_t rate_hello;     // When we last sent a HELLO
+static uint8_t  rate_frames;    // Frames heard since the level changed
+static uint8_t  rate_weak;      // Of those, under the RSSI threshold
+
+static RATE_stats_t rate_stats;
+static rate_entry_t rate_base;      // Level 0
+
+void rateConfigure(uint16_t linkopt2)
+{
+    uint8_t enabled = (linkopt2 & LINKOPT2_ADAPT_RATE) != 0;
+
+    if (enabled == rate_enabled) {
+        return;
+    }
+
+    if (rate_state == RATE_ACCEPTING) {
+        MRF_frame_release(rate_frame);
+    }
+
+    rate_state = RATE_IDLE;
+
+    // Start from the bottom, which is the rate the saved registers set.
+    // Turned off, registers.c writes the saved registers again.
+    if (enabled) {
+        uint16_t drsreg;
+        uint8_t  rxbw, modbw;
+
+        MRF_get_rate(&drsreg, &rxbw, &modbw);
+        rate_base.drsreg = drsreg;
+        rate_base.rxbw   = rxbw;
+        rate_base.modbw  = modbw;
+        rate_pending = 0;
+        rate_nonce   = getTicks();
+    } else {
+        rate_pending = RATE_NONE;
+        rate_stats.level = 0;
+    }
+
+    rate_enabled = enabled;
+}
+
+uint8_t rateEnabled(void)
+{
+    return rate_enabled;
+}
+
+// Returns the frame handle, or -1 if it couldn't be queued.  The frame is
+// encoded into the transmit buffer when it's queued, so it only needs to
+// live on the stack until then.
+static int8_t rate_send(uint8_t command, uint8_t level, uint8_t keep)
+{
+    MRF_packet_t packet;
+
+    packet.payloadSize = RATE_FRAME_LEN;
+    packet.type = PACKET_TYPE_LINK | PACKET_FEC_HAMMING | PACKET_FLAG_CRC;
+    packet.payload[0] = LINK_RATE;
+    packet.payload[LINK_HEADER_LEN + 0] = command;
+    packet.payload[LINK_HEADER_LEN + 1] = level;
+    packet.payload[LINK_HEADER_LEN + 2] = rate_nonce;
+
+    if (keep) {
+        return MRF_transmit_retained(&packet);
+    }
+
+    return MRF_transmit_packet(&packet) ? 0 : -1;
+}
+
+// Switch to the pending level, once the radio is between frames
+static void rate_apply(void)
+{
+    if (rate_pending == RATE_NONE) {
+        return;
+    }
+
+    rate_entry_t entry = rate_base;
+    if (rate_pending > 0) {
+        const rate_entry_t *level = &rate_table[rate_pending - 1];
+        entry.drsreg = pgm_read_word(&level->drsreg);
+        entry.rxbw   = pgm_read_byte(&level->rxbw);
+        entry.modbw  = pgm_read_byte(&level->modbw);
+    }
+
+    if (!MRF_set_rate(entry.drsreg, entry.rxbw, entry.modbw)) {
+        return;
+    }
+
+    rate_stats.level = rate_pending;
+    rate_pending = RATE_NONE;
+    rate_changed = getTicks();
+    rate_heard   = rate_changed;
+    rate_frames  = 0;
+    rate_weak    = 0;
+}
+
+// Give up on a change, and go back to where we were
+static void rate_fall_back(uint8_t level)
+{
+    rate_state   = RATE_IDLE;
+    rate_pending = level;
+    rate_stats.fallbacks++;
+}
+
+static void rate_request(uint8_t level)
+{
+    rate_nonce = rate_nonce * 109 + 89;
+    rate_changed = getTicks();
+
+    if (rate_send(RATE_REQUEST, level, 0) < 0) {
+        return;
+    }
+
+    rate_state    = RATE_REQUESTING;
+    rate_new      = level;
+    rate_old      = rate_stats.level;
+    rate_deadline = rate_changed + RATE_REPLY_TIMEOUT;
+}
+
+// A rate frame from the other side
+static void rate_command(uint8_t command, uint8_t level, uint8_t nonce)
+{
+    uint16_t now = getTicks();
+    int8_t   frame;
+
+    if (level >= RATE_LEVELS) {
+        return;
+    }
+
+    switch (command) {
+        case RATE_REQUEST:
+            // If both sides asked at once, the bigger nonce wins
+            if (rate_state == RATE_REQUESTING && nonce <= rate_nonce) {
+                break;
+            }
+
+            if (rate_state != RATE_IDLE && rate_state != RATE_REQUESTING) {
+                break;
+            }
+
+            frame = rate_send(RATE_ACCEPT, level, 1);
+            if (frame < 0) {
+                rate_state = RATE_IDLE;
+                break;
+            }
+
+            rate_state    = RATE_ACCEPTING;
+            rate_frame    = frame;
+            rate_new      = level;
+            rate_old      = rate_stats.level;
+            rate_asked    = 0;
+            rate_deadline = now + RATE_REPLY_TIMEOUT;
+            break;
+
+        case RATE_ACCEPT:
+            if (rate_state != RATE_REQUESTING || level != rate_new) {
+                break;
+            }
+
+            rate_state     = RATE_PROBATION;
+            rate_pending   = level;
+            rate_asked     = 1;
+            rate_confirmed = 0;
+            rate_deadline  = now + RATE_PROBE_TIMEOUT;
+            break;
+
+        case RATE_CONFIRM:
+            if (rate_state != RATE_PROBATION || rate_pending != RATE_NONE ||
+                level != rate_stats.level) {
+                break;
+            }
+
+            if (!rate_asked) {
+                rate_send(RATE_CONFIRM, level, 0);
+            }
+
+            rate_state = RATE_IDLE;
+            rate_stats.changes++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+MRF_packet_t* rateReceive(void)
+{
+    MRF_packet_t *packet;
+
+    while ((packet = adaptReceive()) != 0) {
+        rate_heard = getTicks();
+        if (rate_frames < 0xFF) {
+            rate_frames++;
+            rate_weak += !packet->rssi;
+        }
+
+        if ((packet->type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK ||
+            !(packet->payload[0] & LINK_RATE)) {
+            return packet;
+        }
+
+        if (rate_enabled && packet->payloadSize == RATE_FRAME_LEN) {
+            rate_command(packet->payload[LINK_HEADER_LEN + 0],
+                         packet->payload[LINK_HEADER_LEN + 1],
+                         packet->payload[LINK_HEADER_LEN + 2]);
+        }
+    }
+
+    return 0;
+}
+
+void ratePoll(void)
+{
+    uint16_t now = getTicks();
+    ADAPT_stats_t adapt;
+    uint8_t level;
+
+    if (!rate_enabled) {
+        return;
+    }
+
+    rate_apply();
+    level = rate_stats.level;
+
+    switch (rate_state) {
+        case RATE_REQUESTING:
+            // No answer, we'll ask again later
+            if ((int16_t)(now - rate_deadline) >= 0) {
+                rate_state = RATE_IDLE;
+            }
+            return;
+
+        case RATE_ACCEPTING:
+            // Switch once our ACCEPT has gone (or it's taking too long)
+            if (MRF_frame_busy(rate_frame) && (int16_t)(now - rate_deadline) < 0) {
+                return;
+            }
+
+            MRF_frame_release(rate_frame);
+            rate_state    = RATE_PROBATION;
+            rate_pending  = rate_new;
+            rate_deadline = now + RATE_PROBE_TIMEOUT;
+            return;
+
+        case RATE_PROBATION:
+            if ((int16_t)(now - rate_deadline) >= 0) {
+                rate_fall_back(rate_old);
+                return;
+            }
+
+            // The side that asked speaks first at the new rate
+            if (rate_asked && !rate_confirmed && rate_pending == RATE_NONE) {
+                rate_confirmed = (rate_send(RATE_CONFIRM, level, 0) == 0);
+            }
+            return;
+
+        case RATE_IDLE:
+            break;
+    }
+
+    if (rate_pending != RATE_NONE) {
+        return;
+    }
+
+    // Lost the other side
+    if (level != 0 && (uint16_t)(now - rate_heard) >= RATE_SILENCE) {
+        rate_fall_back(0);
+        return;
+    }
+
+    // Let the other side know we're still here
+    if (level != 0 && (uint16_t)(now - rate_heard) >= RATE_KEEPALIVE &&
+        (uint16_t)(now - rate_hello) >= RATE_KEEPALIVE) {
+        rate_send(RATE_HELLO, level, 0);
+        rate_hello = now;
+    }
+
+    // Only one change in a while (with a little jitter, so both sides
+    // don't keep asking at the same moment)
+    if ((uint16_t)(now - rate_changed) < RATE_HOLD + (rate_nonce & 0x3F)) {
+        return;
+    }
+
+    adaptGetStats(&adapt);
+
+    if (adapt.score >= RATE_STEP_DOWN && level > 0) {
+        rate_request(level - 1);
+    } else if (adapt.score < RATE_STEP_UP && level + 1 < RATE_LEVELS &&
+               rate_frames >= RATE_MIN_FRAMES && rate_weak == 0) {
+        rate_request(level + 1);
+    }
+}
+
+void rateStop(void)
+{
+    if (!rate_enabled) {
+        return;
+    }
+
+    if (rate_state == RATE_ACCEPTING) {
+        MRF_frame_release(rate_frame);
+    }
+
+    rate_state = RATE_IDLE;
+
+    // There's no later call to retry in, so wait for the radio to finish
+    // the frame it's on
+    if (rate_stats.level != 0 || rate_pending != RATE_NONE) {
+        while (!MRF_set_rate(rate_base.drsreg, rate_base.rxbw, rate_base.modbw)) {
+        }
+    }
+
+    rate_pending = RATE_NONE;
+    rate_stats.level = 0;
+    rate_changed = getTicks();
+}
+
+void rateGetStats(RATE_stats_t *stats)
+{
+    *stats = rate_stats;
+}
+
+#else
+
+// Left out of the build.  Rate frames from the other side are dropped by
+// the packet layer, which doesn't know the link header bit.
+void rateConfigure(uint16_t linkopt2)
+{
+    (void)linkopt2;
+}
+
+uint8_t rateEnabled(void)
+{
+    return 0;
+}
+
+MRF_packet_t* rateReceive(void)
+{
+    return adaptReceive();
+}
+
+void ratePoll(void)
+{
+}
+
+void rateStop(void)
+{
+}
+
+void rateGetStats(RATE_stats_t *stats)
+{
+    memset(stats, 0, sizeof(RATE_stats_t));
+}
+
+#endif
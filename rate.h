@@ -0,0 +1,81 @@
+//
+//  rate.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_rate_h
+#define MRF49XA_Dongle_rate_h
+
+#include <stdint.h>
+#include "MRF49XA.h"
+#include "link.h"
+
+// Adaptive bit rate for the packet modes.
+//
+// With this on, the bit rate (with the receive bandwidth and deviation to
+// match) comes from a table of levels in rate.c, slowest first.  Level 0
+// is the rate the saved DRSREG, RXCREG and TXCREG set up when the option
+// is turned on (9579 bps by default), the table is meant to be faster than
+// that.  Both sides have to be at the same level to hear each other, so a
+// change is agreed on with link frames that have LINK_RATE set, and a
+// command and level after the link header:
+//
+//   REQUEST  Sent at the old rate, by the side that wants the change
+//   ACCEPT   Sent at the old rate.  The sender switches once it's gone.
+//   CONFIRM  Sent at the new rate, first by the side that asked, then in
+//            reply by the other.  Either side that doesn't hear one within
+//            RATE_PROBE_TIMEOUT goes back to the old rate.
+//   HELLO    Sent above level 0 when nothing has been heard for
+//            RATE_KEEPALIVE ticks, so silence means something
+//
+// Above level 0, hearing nothing at all for RATE_SILENCE ticks means the
+// two sides have lost each other, and both drop back to level 0.
+//
+// A side asks to go up a level when its own receiving has been clean (its
+// link quality score, adapt.h, is under RATE_STEP_UP) and every frame has
+// been over the RSSI threshold for RATE_HOLD ticks, and down a level when
+// its score reaches RATE_STEP_DOWN.  Frames in flight when the rate
+// changes can be lost, ARQ sends those again.
+#define RATE_FRAME_LEN      (LINK_HEADER_LEN + 3)
+
+#define RATE_REQUEST        1
+#define RATE_ACCEPT         2
+#define RATE_CONFIRM        3
+#define RATE_HELLO          4
+
+#define RATE_STEP_UP        8
+#define RATE_STEP_DOWN      96
+#define RATE_MIN_FRAMES     16      // Frames heard before going up
+#define RATE_HOLD           610     // Ticks (8.192 mS each), about 5 S
+#define RATE_REPLY_TIMEOUT  32      // Ticks to wait for an ACCEPT
+#define RATE_PROBE_TIMEOUT  64      // Ticks to wait for a CONFIRM
+#define RATE_KEEPALIVE      122     // About 1 S
+#define RATE_SILENCE        488     // About 4 S
+
+typedef struct {
+    uint8_t  level;         // Rate in use now
+    uint16_t changes;       // Changes agreed with the other side
+    uint16_t fallbacks;     // Changes given up on, or the link lost
+} RATE_stats_t;
+
+void    rateConfigure(uint16_t linkopt2);
+uint8_t rateEnabled(void);
+
+// The next received packet, after the rate frames have been dealt with.
+// Valid until the next call.
+MRF_packet_t* rateReceive(void);
+
+// Handshake timers and keepalives, call this often from the main loop
+void ratePoll(void);
+
+// Leaving the packet modes, nothing calls ratePoll() after this.  Goes
+// back to level 0 (the saved registers), the other side falls back to it
+// once it stops hearing us.
+void rateStop(void);
+
+void rateGetStats(RATE_stats_t *stats);
+
+#endif
@@ -11,6 +11,11 @@
 #include "registers.h"
 #include "modes.h"
 #include "MRF49XA.h"
+#include "arq.h"
+#include "adapt.h"
+#include "rate.h"
+#include "tdma.h"
+#include "packet.h"
 #include "utilities.h"
 #include <LUFA/Drivers/USB/Class/Device/CDC.h>
 extern USB_ClassInfo_CDC_Device_t CDC_interface;
@@ -46,6 +51,81 @@ uint16_t EEMEM pllcreg     = 0xCC77;
 #define synbreg    (void *)0x0010
 #define drsreg     (void *)0x0012
 #define pllcreg    (void *)0x0014
+#define linkopt    (void *)0x0016
+#define linkopt2   (void *)0x0018
+#define tdmareg    (void *)0x001A
+
+// The link options aren't a transceiver register, they're the frame
+// options (PACKET_FLAG_*) added to every packet sent, and the ARQ settings
+// (see link.h).  Receiving doesn't depend on them, so dongles with different
+// options can still talk.  Erased EEPROM (from older firmware) means no
+// options.
+#define LINKOPT_ERASED 0xFFFF
+
+// ARQ, rate and FEC adaptation keep state for one other dongle, and frames
+// don't say who sent them.  Time slots are for more dongles than that, so
+// those options are left off while TDMA is on (tdma.h).
+static uint8_t tdmaSaved(void)
+{
+    uint16_t value = eeprom_read_word(tdmareg);
+    return value != LINKOPT_ERASED && (value & TDMA_REG_ENABLE);
+}
+
+static void applyLinkOptions(uint16_t value)
+{
+    if (value == LINKOPT_ERASED) {
+        value = 0;
+    }
+    
+    if (tdmaSaved()) {
+        value &= ~LINKOPT_ARQ;
+    }
+    
+    MRF_set_tx_flags(value & LINKOPT_PACKET_MASK);
+    arqConfigure(value);
+    packetConfigure(value);
+}
+
+// The second word is more of the same, for options that didn't fit
+static void applyLinkOptions2(uint16_t value)
+{
+    if (value == LINKOPT_ERASED) {
+        value = 0;
+    }
+    
+    if (tdmaSaved()) {
+        value &= ~(LINKOPT2_ADAPT_FEC | LINKOPT2_ADAPT_RATE);
+    }
+    
+    MRF_set_erasure_mark((value & LINKOPT2_MARK_ERASURES) != 0);
+    MRF_set_interleave(LINKOPT2_INTERLEAVE(value));
+    MRF_set_coded_header((value & LINKOPT2_CODED_HEADER) != 0);
+    MRF_set_whiten_types(LINKOPT2_WHITEN_TYPES(value));
+    MRF_set_csma((value & LINKOPT2_CSMA) != 0);
+    adaptConfigure(value);
+    
+    // Going back to the saved bit rate
+    if (rateEnabled() && !(value & LINKOPT2_ADAPT_RATE)) {
+        MRF_registerSet(eeprom_read_word(txcreg));
+        MRF_registerSet(eeprom_read_word(rxcreg));
+        MRF_registerSet(eeprom_read_word(drsreg));
+    }
+    
+    rateConfigure(value);
+}
+
+// The time slot schedule (tdma.h), which is off in erased EEPROM too.
+// This has to be saved first, the link options depend on it.
+static void applyTdma(uint16_t value)
+{
+    if (value == LINKOPT_ERASED) {
+        value = 0;
+    }
+    
+    tdmaConfigure(value);
+    applyLinkOptions(eeprom_read_word(linkopt));
+    applyLinkOptions2(eeprom_read_word(linkopt2));
+}
 
 void setEEPROMdefaults(void)
 {
@@ -59,6 +139,9 @@ void setEEPROMdefaults(void)
     eeprom_write_word(synbreg,    0xCED4);
     eeprom_write_word(drsreg,     0xC623);
     eeprom_write_word(pllcreg,    0xCC77);
+    eeprom_write_word(linkopt,    0x0000);
+    eeprom_write_word(linkopt2,   0x0000);
+    eeprom_write_word(tdmareg,    0x0000);
 }
 
 uint8_t getBootState(void)
@@ -95,6 +178,7 @@ void applySavedRegisters(void)
     MRF_registerSet(eeprom_read_word(synbreg));
     MRF_registerSet(eeprom_read_word(drsreg));
     MRF_registerSet(eeprom_read_word(pllcreg));
+    applyTdma(eeprom_read_word(tdmareg));
 }
 
 const uint8_t afcregString[]     PROGMEM = "\n\r0) AFCREG:     ";
@@ -106,6 +190,9 @@ const uint8_t fiforstregString[] PROGMEM = "\n\r5) FIFORSTREG: ";
 const uint8_t synbregString[]    PROGMEM = "\n\r6) SYNBREG:    ";
 const uint8_t drsregString[]     PROGMEM = "\n\r7) DRSREG:     ";
 const uint8_t pllcregString[]    PROGMEM = "\n\r8) PLLCREG:    ";
+const uint8_t linkoptString[]    PROGMEM = "\n\r9) LINKOPT:    ";
+const uint8_t linkopt2String[]   PROGMEM = "\n\rA) LINKOPT2:   ";
+const uint8_t tdmaregString[]    PROGMEM = "\n\rB) TDMA:       ";
 
 void printSavedRegisters(void)
 {
@@ -127,6 +214,12 @@ void printSavedRegisters(void)
     print_hex(eeprom_read_word(drsreg));
     sendStringP(pllcregString);
     print_hex(eeprom_read_word(pllcreg));
+    sendStringP(linkoptString);
+    print_hex(eeprom_read_word(linkopt));
+    sendStringP(linkopt2String);
+    print_hex(eeprom_read_word(linkopt2));
+    sendStringP(tdmaregString);
+    print_hex(eeprom_read_word(tdmareg));
     CDC_Device_Flush(&CDC_interface);
 }
 
@@ -170,6 +263,18 @@ void setRegisterValue(uint8_t index, uint16_t value)
             eeprom_write_word(pllcreg, value);
             MRF_registerSet(value);
             break;
+        case 9:
+            eeprom_write_word(linkopt, value);
+            applyLinkOptions(value);
+            break;
+        case 10:
+            eeprom_write_word(linkopt2, value);
+            applyLinkOptions2(value);
+            break;
+        case 11:
+            eeprom_write_word(tdmareg, value);
+            applyTdma(value);
+            break;
         default:
             return;
     }
@@ -0,0 +1,319 @@
+//
+//  rs8.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+//  Reed-Solomon coding over GF(256), after Phil Karn's rs8 (LGPL Licensed)
+//
+
+#include <string.h>
+#include "rs8.h"
+
+// Left out of the build with MRF_NO_RS, see MRF49XA.h
+#ifndef MRF_NO_RS
+
+// The field is generated by x^8 + x^4 + x^3 + x^2 + 1 (0x11D), and the
+// generator polynomial's roots are alpha^1 to alpha^RS_NROOTS.  Field
+// elements are kept either as themselves, or in "index" form, as the power
+// of alpha they are.  Zero has no power, it's written as RS_A0.
+#define RS_NN       255
+#define RS_A0       RS_NN
+#define RS_FCR      1
+
+// The tables live in flash, there's no room for 512 bytes of them in RAM
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+
+    const uint8_t rs_alpha_to[256] PROGMEM = {
+#else
+#define pgm_read_byte(value) *(value)
+
+    const uint8_t rs_alpha_to[256] = {
+#endif
+0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26,
+    0x4C, 0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0,
+    0x9D, 0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23,
+    0x46, 0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1,
+    0x5F, 0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0,
+    0xFD, 0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2,
+    0xD9, 0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE,
+    0x81, 0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC,
+    0x85, 0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54,
+    0xA8, 0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73,
+    0xE6, 0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF,
+    0xE3, 0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41,
+    0x82, 0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6,
+    0x51, 0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09,
+    0x12, 0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16,
+    0x2C, 0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E, 0x00
+};
+
+#ifdef __AVR__
+    const uint8_t rs_index_of[256] PROGMEM = {
+#else
+    const uint8_t rs_index_of[256] = {
+#endif
+    0xFF, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1A, 0xC6, 0x03, 0xDF, 0x33, 0xEE, 0x1B, 0x68, 0xC7, 0x4B,
+    0x04, 0x64, 0xE0, 0x0E, 0x34, 0x8D, 0xEF, 0x81, 0x1C, 0xC1, 0x69, 0xF8, 0xC8, 0x08, 0x4C, 0x71,
+    0x05, 0x8A, 0x65, 0x2F, 0xE1, 0x24, 0x0F, 0x21, 0x35, 0x93, 0x8E, 0xDA, 0xF0, 0x12, 0x82, 0x45,
+    0x1D, 0xB5, 0xC2, 0x7D, 0x6A, 0x27, 0xF9, 0xB9, 0xC9, 0x9A, 0x09, 0x78, 0x4D, 0xE4, 0x72, 0xA6,
+    0x06, 0xBF, 0x8B, 0x62, 0x66, 0xDD, 0x30, 0xFD, 0xE2, 0x98, 0x25, 0xB3, 0x10, 0x91, 0x22, 0x88,
+    0x36, 0xD0, 0x94, 0xCE, 0x8F, 0x96, 0xDB, 0xBD, 0xF1, 0xD2, 0x13, 0x5C, 0x83, 0x38, 0x46, 0x40,
+    0x1E, 0x42, 0xB6, 0xA3, 0xC3, 0x48, 0x7E, 0x6E, 0x6B, 0x3A, 0x28, 0x54, 0xFA, 0x85, 0xBA, 0x3D,
+    0xCA, 0x5E, 0x9B, 0x9F, 0x0A, 0x15, 0x79, 0x2B, 0x4E, 0xD4, 0xE5, 0xAC, 0x73, 0xF3, 0xA7, 0x57,
+    0x07, 0x70, 0xC0, 0xF7, 0x8C, 0x80, 0x63, 0x0D, 0x67, 0x4A, 0xDE, 0xED, 0x31, 0xC5, 0xFE, 0x18,
+    0xE3, 0xA5, 0x99, 0x77, 0x26, 0xB8, 0xB4, 0x7C, 0x11, 0x44, 0x92, 0xD9, 0x23, 0x20, 0x89, 0x2E,
+    0x37, 0x3F, 0xD1, 0x5B, 0x95, 0xBC, 0xCF, 0xCD, 0x90, 0x87, 0x97, 0xB2, 0xDC, 0xFC, 0xBE, 0x61,
+    0xF2, 0x56, 0xD3, 0xAB, 0x14, 0x2A, 0x5D, 0x9E, 0x84, 0x3C, 0x39, 0x53, 0x47, 0x6D, 0x41, 0xA2,
+    0x1F, 0x2D, 0x43, 0xD8, 0xB7, 0x7B, 0xA4, 0x76, 0xC4, 0x17, 0x49, 0xEC, 0x7F, 0x0C, 0x6F, 0xF6,
+    0x6C, 0xA1, 0x3B, 0x52, 0x29, 0x9D, 0x55, 0xAA, 0xFB, 0x60, 0x86, 0xB1, 0xBB, 0xCC, 0x3E, 0x5A,
+    0xCB, 0x59, 0x5F, 0xB0, 0x9C, 0xA9, 0xA0, 0x51, 0x0B, 0xF5, 0x16, 0xEB, 0x7A, 0x75, 0x2C, 0xD7,
+    0x4F, 0xAE, 0xD5, 0xE9, 0xE6, 0xE7, 0xAD, 0xE8, 0x74, 0xD6, 0xF4, 0xEA, 0xA8, 0x50, 0x58, 0xAF
+};
+
+#define alpha_to(x) pgm_read_byte(&rs_alpha_to[x])
+#define index_of(x) pgm_read_byte(&rs_index_of[x])
+
+// Generator polynomial, in index form
+static uint8_t genpoly[RS_NROOTS + 1];
+
+// x % 255, without a divide
+static uint8_t modnn(uint16_t x)
+{
+    while (x >= RS_NN) {
+        x -= RS_NN;
+        x = (x >> 8) + (x & RS_NN);
+    }
+
+    return x;
+}
+
+void rs_init(void)
+{
+    uint8_t i, j, root;
+
+    genpoly[0] = 1;
+    for (i = 0, root = RS_FCR; i < RS_NROOTS; i++, root++) {
+        genpoly[i + 1] = 1;
+
+        // Multiply by (x + alpha^root)
+        for (j = i; j > 0; j--) {
+            if (genpoly[j] != 0) {
+                genpoly[j] = genpoly[j - 1] ^ alpha_to(modnn(index_of(genpoly[j]) + root));
+            } else {
+                genpoly[j] = genpoly[j - 1];
+            }
+        }
+        genpoly[0] = alpha_to(modnn(index_of(genpoly[0]) + root));
+    }
+
+    for (i = 0; i <= RS_NROOTS; i++) {
+        genpoly[i] = index_of(genpoly[i]);
+    }
+}
+
+// The parity is the remainder of the data divided by the generator, this
+// is one step of the long division.
+void rs_encode(uint8_t *parity, uint8_t byte)
+{
+    uint8_t feedback = index_of(byte ^ parity[0]);
+    uint8_t j;
+
+    for (j = 1; j < RS_NROOTS; j++) {
+        parity[j - 1] = parity[j];
+        if (feedback != RS_A0) {
+            parity[j - 1] ^= alpha_to(modnn(feedback + genpoly[RS_NROOTS - j]));
+        }
+    }
+
+    parity[RS_NROOTS - 1] = (feedback != RS_A0) ? alpha_to(modnn(feedback + genpoly[0])) : 0;
+}
+
+// Berlekamp-Massey to find the error locator, a Chien search for its roots
+// (the error positions) and Forney's algorithm for the error values.  This
+// takes a few milliseconds for a full frame, so it's only done from main.
+int8_t rs_decode(uint8_t *codeword, uint8_t length)
+{
+    uint8_t lambda[RS_NROOTS + 1];  // Error locator
+    uint8_t s[RS_NROOTS];           // Syndromes, index form
+    uint8_t b[RS_NROOTS + 1];
+    uint8_t t[RS_NROOTS + 1];
+    uint8_t omega[RS_NROOTS + 1];   // Error evaluator
+    uint8_t root[RS_NROOTS];
+    uint8_t loc[RS_NROOTS];
+    uint8_t deg_lambda, deg_omega, el, r, count, discr, q, syn_error;
+    uint8_t pad = RS_NN - length;
+    int8_t  i, j;
+    uint16_t k;
+
+    if (length <= RS_NROOTS) {
+        return -1;
+    }
+
+    // Evaluate the codeword at the roots of the generator
+    for (i = 0; i < RS_NROOTS; i++) {
+        s[i] = codeword[0];
+    }
+
+    for (k = 1; k < length; k++) {
+        for (i = 0; i < RS_NROOTS; i++) {
+            if (s[i] == 0) {
+                s[i] = codeword[k];
+            } else {
+                s[i] = codeword[k] ^ alpha_to(modnn(index_of(s[i]) + RS_FCR + i));
+            }
+        }
+    }
+
+    syn_error = 0;
+    for (i = 0; i < RS_NROOTS; i++) {
+        syn_error |= s[i];
+        s[i] = index_of(s[i]);
+    }
+
+    // It's a codeword, nothing to do
+    if (!syn_error) {
+        return 0;
+    }
+
+    memset(&lambda[1], 0, RS_NROOTS);
+    lambda[0] = 1;
+
+    for (i = 0; i <= RS_NROOTS; i++) {
+        b[i] = index_of(lambda[i]);
+    }
+
+    el = 0;
+    for (r = 1; r <= RS_NROOTS; r++) {
+        // Discrepancy at step r, in index form
+        discr = 0;
+        for (i = 0; i < r; i++) {
+            if (lambda[i] != 0 && s[r - i - 1] != RS_A0) {
+                discr ^= alpha_to(modnn(index_of(lambda[i]) + s[r - i - 1]));
+            }
+        }
+        discr = index_of(discr);
+
+        if (discr == RS_A0) {
+            // b(x) = x * b(x)
+            memmove(&b[1], b, RS_NROOTS);
+            b[0] = RS_A0;
+            continue;
+        }
+
+        // t(x) = lambda(x) - discr * x * b(x)
+        t[0] = lambda[0];
+        for (i = 0; i < RS_NROOTS; i++) {
+            if (b[i] != RS_A0) {
+                t[i + 1] = lambda[i + 1] ^ alpha_to(modnn(discr + b[i]));
+            } else {
+                t[i + 1] = lambda[i + 1];
+            }
+        }
+
+        if (2 * el <= r - 1) {
+            el = r - el;
+            // b(x) = lambda(x) / discr
+            for (i = 0; i <= RS_NROOTS; i++) {
+                b[i] = (lambda[i] == 0) ? RS_A0 : modnn(index_of(lambda[i]) - discr + RS_NN);
+            }
+        } else {
+            memmove(&b[1], b, RS_NROOTS);
+            b[0] = RS_A0;
+        }
+
+        memcpy(lambda, t, RS_NROOTS + 1);
+    }
+
+    // Convert lambda to index form and find its degree
+    deg_lambda = 0;
+    for (i = 0; i <= RS_NROOTS; i++) {
+        lambda[i] = index_of(lambda[i]);
+        if (lambda[i] != RS_A0) {
+            deg_lambda = i;
+        }
+    }
+
+    if (deg_lambda == 0 || deg_lambda > RS_NROOTS / 2) {
+        return -1;
+    }
+
+    // Find the roots of lambda by trying every power of alpha (the Chien
+    // search).  t holds the terms as they're stepped along.
+    memcpy(&t[1], &lambda[1], RS_NROOTS);
+    count = 0;
+    for (k = 1; k <= RS_NN; k++) {
+        q = 1;
+        for (j = deg_lambda; j > 0; j--) {
+            if (t[j] != RS_A0) {
+                t[j] = modnn(t[j] + j);
+                q ^= alpha_to(t[j]);
+            }
+        }
+
+        if (q != 0) {
+            continue;
+        }
+
+        // An error in the part that was shortened off means it's wrong
+        if ((uint8_t)(k - 1) < pad) {
+            return -1;
+        }
+
+        root[count] = k;
+        loc[count]  = k - 1;
+        if (++count == deg_lambda) {
+            break;
+        }
+    }
+
+    // Lambda has roots that aren't in the field, too many errors
+    if (count != deg_lambda) {
+        return -1;
+    }
+
+    // omega(x) = s(x) * lambda(x) mod x^RS_NROOTS, in index form
+    deg_omega = deg_lambda - 1;
+    for (i = 0; i <= deg_omega; i++) {
+        uint8_t tmp = 0;
+        for (j = i; j >= 0; j--) {
+            if (s[i - j] != RS_A0 && lambda[j] != RS_A0) {
+                tmp ^= alpha_to(modnn(s[i - j] + lambda[j]));
+            }
+        }
+        omega[i] = index_of(tmp);
+    }
+
+    // The error values are omega(1/X) / lambda'(1/X), with RS_FCR = 1
+    for (j = count - 1; j >= 0; j--) {
+        uint8_t num = 0;
+        uint8_t den = 0;
+
+        for (i = deg_omega; i >= 0; i--) {
+            if (omega[i] != RS_A0) {
+                num ^= alpha_to(modnn(omega[i] + (uint16_t)i * root[j]));
+            }
+        }
+
+        // lambda' only has the odd terms of lambda
+        for (i = (deg_lambda - 1) & ~1; i >= 0; i -= 2) {
+            if (lambda[i + 1] != RS_A0) {
+                den ^= alpha_to(modnn(lambda[i + 1] + (uint16_t)i * root[j]));
+            }
+        }
+
+        if (den == 0) {
+            return -1;
+        }
+
+        if (num != 0) {
+            codeword[loc[j] - pad] ^= alpha_to(modnn(index_of(num) + RS_NN - index_of(den)));
+        }
+    }
+
+    return count;
+}
+
+#endif
@@ -0,0 +1,36 @@
+//
+//  rs8.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+//  Reed-Solomon coding over GF(256), after Phil Karn's rs8 (LGPL Licensed)
+//
+
+#ifndef MRF49XA_Dongle_rs8_h
+#define MRF49XA_Dongle_rs8_h
+
+#include <stdint.h>
+
+// Parity bytes per codeword.  The code corrects up to RS_NROOTS / 2 bad
+// bytes anywhere in the codeword.  Every receive slot has room for this
+// many bytes after the payload, so each one costs a few bytes of RAM.
+#define RS_NROOTS   8
+
+#if (RS_NROOTS < 2) || (RS_NROOTS > 16) || (RS_NROOTS & 1)
+#error RS_NROOTS must be even, from 2 to 16
+#endif
+
+// Codewords are shortened from 255 bytes: the data is followed by the
+// parity, and the whole thing can be any length up to 255 bytes.
+void rs_init(void);
+
+// Add a data byte to the parity, which must start out as all zeros
+void rs_encode(uint8_t *parity, uint8_t byte);
+
+// Correct a codeword (data and parity) in place.  Returns the number of
+// bytes corrected, or -1 if there were too many errors to correct.
+int8_t rs_decode(uint8_t *codeword, uint8_t length);
+
+#endif
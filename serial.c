@@ -24,6 +24,8 @@ extern volatile MRF_packet_t packet;
 #define TICKS_BYTE_DEADLINE 36
 extern volatile uint16_t ticks;
 
+// If the transmit queue is full, the packet is left alone and this is
+// retried from the main loop.  No new bytes are accepted until it goes.
 void serialTransmitPacket(void)
 {
     packet.payloadSize = counter;
@@ -33,8 +35,9 @@ void serialTransmitPacket(void)
         packet.type = PACKET_TYPE_SERIAL;
     }
     
-    MRF_transmit_packet(&packet);
-    counter = 0;
+    if (MRF_transmit_packet((MRF_packet_t *)&packet)) {
+        counter = 0;
+    }
 }
 
 // Byte received from the USB port
@@ -58,13 +61,19 @@ void serialMainLoop(void)
 {
     static uint16_t sendDeadline = 0;
     
+    // A full packet is still waiting for the transmit queue
+    if (counter == MRF_PAYLOAD_LEN) {
+        serialTransmitPacket();
+    }
+    
     // Handle new bytes from USB
-    if (CDC_Device_BytesReceived(&CDC_interface) > 0) {
+    if (counter < MRF_PAYLOAD_LEN &&
+        CDC_Device_BytesReceived(&CDC_interface) > 0) {
         sendDeadline = ticks + TICKS_BYTE_DEADLINE;
         serialByteReceved(CDC_Device_ReceiveByte(&CDC_interface));
     }
     
-    if (UCSR1A & (1 << RXC1)) {
+    if (counter < MRF_PAYLOAD_LEN && (UCSR1A & (1 << RXC1))) {
         sendDeadline = ticks + TICKS_BYTE_DEADLINE;
         uint8_t byte = UDR1;
         serialByteReceved(byte);
@@ -79,7 +88,7 @@ void serialMainLoop(void)
     
     // Handle new packets from radio
     MRF_packet_t *rx_packet = MRF_receive_packet();
-    if (rx_packet) {
+    if (rx_packet && (rx_packet->type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK) {
         // Print the packet contents directly to USB
         CDC_Device_SendData(&CDC_interface,
                             rx_packet->payload,
@@ -12,15 +12,24 @@
 // This variable is vital for SW SPI, and 16 bit HW SPI.
 volatile uint16_t spi_read_buffer;
 
-volatile uint8_t mutex;
+// These functions don't do any locking.  A transaction must not be
+// interrupted by another one on the same bus (it would corrupt the chip
+// select and the read buffer), so callers that share the bus with an ISR
+// need to mask interrupts around their transactions.  See MRF49XA.c.
 
 // This function assumes that the CS pins for peripherals are already "inactive"
 void spi_init(void)
 {
 #ifndef SOFTWARE_SPI
+	// The SS pin must be an output, or the SPI will drop out of master mode
+	// if something pulls it low.
+	SPI_SS_DDRx    |=  (1 << SPI_SS_BIT);
+
 	// Setup the hardware SPI interface
-	SPCR   =  0x50;		// set up SPI mode
-	SPSR   =  0x01;		// double speed operation	
+	// Mode 0, MSB first, master, F_CPU/4 (2 MHz).  The MRF49XA can't have
+	// its FIFO read faster than fxtal/4 (2.5 MHz), so no double speed.
+	SPCR   =  (1 << SPE) | (1 << MSTR);
+	SPSR   =  0x00;
 #endif
 
 	// Setup the port pins for HW and SW SPI interface
@@ -52,10 +61,6 @@ void spi_write8(uint8_t data, volatile uint8_t *enable_port, uint8_t enable_pin)
 {
 	int i = 0;
 
-	// Spin on the mutex
-	while (mutex);
-	mutex = 1;
-	
 	// Bring the enable pin low to enable SPI on the peripheral
 	*enable_port &= ~(1 << enable_pin);
 	spi_read_buffer = 0;
@@ -88,19 +93,15 @@ void spi_write8(uint8_t data, volatile uint8_t *enable_port, uint8_t enable_pin)
 	// Return the enable pin and MOSI to the inactive state
 	SPI_MOSI_PORTx &= ~(1 << SPI_MOSI_BIT); // Set port value to 0
 	*enable_port |= (1 << enable_pin);
-	
-	mutex = 0;
 }
 
 void spi_write16(uint16_t data, uint16_t mask,
                  volatile uint8_t *enable_port, uint8_t enable_pin)
-{/*
+{
+	(void)mask;
+/*
     int i = 0;
     
-    // Spin on the mutex
-    while (mutex);
-    mutex = 1;
-    
     // Bring the enable pin low to enable SPI on the peripheral
     *enable_port &= ~(1 << enable_pin);
     spi_read_buffer = 0;
@@ -150,15 +151,9 @@ void spi_write16(uint16_t data, uint16_t mask,
     // Return the enable pin and MOSI to the inactive state
     SPI_MOSI_PORTx &= ~(1 << SPI_MOSI_BIT); // Set port value to 0
     *enable_port |= (1 << enable_pin);
-    
-    mutex = 0;
 */
 	int i = 0;
 	
-	// Spin on the mutex
-	while (mutex);
-	mutex = 1;
-	
 	// Bring the enable pin low to enable SPI on the peripheral
 	*enable_port &= ~(1 << enable_pin);
 	spi_read_buffer = 0;
@@ -191,19 +186,16 @@ void spi_write16(uint16_t data, uint16_t mask,
 	// Return the enable pin and MOSI to the inactive state
 	SPI_MOSI_PORTx &= ~(1 << SPI_MOSI_BIT); // Set port value to 0
 	*enable_port |= (1 << enable_pin);
-	
-	mutex = 0;
 
 }
 
 #else
 
+// Test menu option 7 times one register write with timer 1, so this and
+// the SOFTWARE_SPI build can be compared on a board.
+
 void spi_write8(uint8_t data, volatile uint8_t *enable_port, uint8_t enable_pin)
 {
-	// Spin on the mutex
-	while (mutex);
-	mutex = 1;
-	
 	// Bring the enable pin low to enable SPI on the peripheral
 	*enable_port &= ~(1 << enable_pin);
 	
@@ -215,16 +207,15 @@ void spi_write8(uint8_t data, volatile uint8_t *enable_port, uint8_t enable_pin)
 	
 	// Return the enable pin to the inactive state
 	*enable_port |= (1 << enable_pin);
-	
-	mutex = 0;
 }
 
-void spi_write16(uint16_t data, volatile uint8_t *enable_port, uint8_t enable_pin)
+// The SPI hardware always drives MOSI, so the mask argument is ignored here.
+// (The software version doesn't use it either.)
+void spi_write16(uint16_t data, uint16_t mask,
+                 volatile uint8_t *enable_port, uint8_t enable_pin)
 {
-	// Spin on the mutex
-	while (mutex);
-	mutex = 1;
-	
+	(void)mask;
+
 	// Bring the enable pin low to enable SPI on the peripheral
 	*enable_port &= ~(1 << enable_pin);
 	
@@ -244,8 +235,6 @@ void spi_write16(uint16_t data, volatile uint8_t *enable_port, uint8_t enable_pi
 	
 	// Return the enable pin to the inactive state
 	*enable_port |= (1 << enable_pin);
-	
-	mutex = 0;
 }
 
 #endif
@@ -0,0 +1,243 @@
+//
+//  tdma.c
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "tdma.h"
+#include "rate.h"
+
+#ifndef LINK_NO_TDMA
+
+// The schedule.  This is run from the timer ISR, main only changes it with
+// interrupts off.
+static volatile uint8_t tdma_enabled;
+static volatile uint8_t tdma_running;   // In a packet mode, see tdmaStart()
+static volatile uint8_t tdma_length;    // Ticks per slot
+static volatile uint8_t tdma_slots;     // Slots per superframe
+static volatile uint8_t tdma_mine;      // Our slot
+static volatile uint8_t tdma_tick;      // Ticks into the current slot
+static volatile uint8_t tdma_slot;      // The current slot
+static volatile uint8_t tdma_missed;    // Superframes since the last beacon
+static volatile uint8_t tdma_beacon_due;
+
+static uint8_t tdma_sequence;
+static TDMA_stats_t tdma_stats;
+
+// Change the schedule, with the ISR held off
+static void tdma_schedule(uint8_t length, uint8_t slots)
+{
+    uint8_t sreg = SREG;
+    cli();
+    tdma_length = length;
+    tdma_slots  = slots;
+    tdma_slot   = 0;
+    tdma_tick   = TDMA_BEACON_DELAY;
+    tdma_missed = 0;
+    SREG = sreg;
+}
+
+// Start again out of step, which is also how we start.  While the slots
+// are running nothing goes until our slot comes around, otherwise the
+// window is left open.
+static void tdma_restart(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    tdma_slot    = 0;
+    tdma_tick    = 0;
+    tdma_missed  = 0xFF;        // Not in step until a beacon comes
+    tdma_beacon_due = 0;
+    SREG = sreg;
+
+    MRF_tx_window((tdma_enabled && tdma_running) ? 0 : MRF_TX_WINDOW_OPEN);
+}
+
+void tdmaConfigure(uint16_t reg)
+{
+    uint8_t length = TDMA_REG_LENGTH(reg);
+    uint8_t slots  = TDMA_REG_SLOTS(reg);
+
+    if (length == 0) {
+        length = TDMA_SLOT_DEFAULT;
+    }
+
+    if (slots < 2) {
+        slots = TDMA_SLOTS_DEFAULT;
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    tdma_enabled = (reg & TDMA_REG_ENABLE) != 0;
+    tdma_length  = length;
+    tdma_slots   = slots;
+    tdma_mine    = TDMA_REG_SLOT(reg) % slots;
+    SREG = sreg;
+
+    tdma_restart();
+}
+
+void tdmaStart(void)
+{
+    tdma_running = 1;
+    tdma_restart();
+}
+
+void tdmaStop(void)
+{
+    tdma_running = 0;
+    tdma_restart();
+}
+
+uint8_t tdmaEnabled(void)
+{
+    return tdma_enabled;
+}
+
+void tdmaTick(void)
+{
+    if (!tdma_enabled || !tdma_running || ++tdma_tick < tdma_length) {
+        return;
+    }
+
+    tdma_tick = 0;
+    if (++tdma_slot >= tdma_slots) {
+        tdma_slot = 0;
+        if (tdma_missed < 0xFF) {
+            tdma_missed++;
+        }
+    }
+
+    if (tdma_slot != tdma_mine) {
+        return;
+    }
+
+    // The coordinator's slot opens once the beacon is queued, so it's the
+    // first thing sent.  Everyone else goes only if they're in step.
+    if (tdma_mine == 0) {
+        tdma_beacon_due = 1;
+    } else if (tdma_missed <= TDMA_BEACONS_LOST) {
+        MRF_tx_window(tdma_length - TDMA_GUARD);
+    }
+}
+
+MRF_packet_t* tdmaReceive(void)
+{
+    MRF_packet_t *packet;
+
+    while ((packet = rateReceive()) != 0) {
+        if ((packet->type & PACKET_TYPE_MASK) != PACKET_TYPE_LINK ||
+            !(packet->payload[0] & LINK_BEACON)) {
+            return packet;
+        }
+
+        // Coordinators don't follow anyone else
+        if (!tdma_enabled || tdma_mine == 0 || packet->payloadSize != TDMA_BEACON_LEN) {
+            continue;
+        }
+
+        uint8_t length = packet->payload[LINK_HEADER_LEN + 0];
+        uint8_t slots  = packet->payload[LINK_HEADER_LEN + 1];
+        if (length <= TDMA_GUARD || slots < 2 || slots > TDMA_SLOTS_MAX) {
+            continue;
+        }
+
+        tdma_schedule(length, slots);
+        tdma_stats.beaconsHeard++;
+    }
+
+    return 0;
+}
+
+void tdmaPoll(void)
+{
+    if (!tdma_beacon_due) {
+        return;
+    }
+
+    // Too late for this superframe, a late beacon would put the others out
+    if (tdma_slot != 0 || tdma_tick > TDMA_BEACON_DELAY) {
+        tdma_beacon_due = 0;
+        return;
+    }
+
+    // The beacon is encoded into the transmit buffer when it's queued, so
+    // it only needs to live on the stack until then
+    MRF_packet_t beacon;
+    beacon.payloadSize = TDMA_BEACON_LEN;
+    beacon.type = PACKET_TYPE_LINK | PACKET_FLAG_CRC;
+    beacon.payload[0] = LINK_BEACON;
+    beacon.payload[LINK_HEADER_LEN + 0] = tdma_length;
+    beacon.payload[LINK_HEADER_LEN + 1] = tdma_slots;
+    beacon.payload[LINK_HEADER_LEN + 2] = tdma_sequence;
+
+    if (!MRF_transmit_first(&beacon)) {
+        return;
+    }
+
+    tdma_sequence++;
+    tdma_stats.beaconsSent++;
+
+    // Open what's left of our slot
+    uint8_t sreg = SREG;
+    cli();
+    tdma_beacon_due = 0;
+    if (tdma_slot == 0 && tdma_tick + TDMA_GUARD < tdma_length) {
+        MRF_tx_window(tdma_length - TDMA_GUARD - tdma_tick);
+    }
+    SREG = sreg;
+}
+
+void tdmaGetStats(TDMA_stats_t *stats)
+{
+    *stats = tdma_stats;
+    stats->slot   = tdma_slot;
+    stats->synced = tdma_enabled && (tdma_mine == 0 || tdma_missed <= TDMA_BEACONS_LOST);
+}
+
+#else
+
+// Left out of the build, the transmit window is always open.  Beacons
+// from a coordinator are dropped by the packet layer.
+void tdmaConfigure(uint16_t reg)
+{
+    (void)reg;
+}
+
+uint8_t tdmaEnabled(void)
+{
+    return 0;
+}
+
+void tdmaStart(void)
+{
+}
+
+void tdmaStop(void)
+{
+}
+
+void tdmaTick(void)
+{
+}
+
+MRF_packet_t* tdmaReceive(void)
+{
+    return rateReceive();
+}
+
+void tdmaPoll(void)
+{
+}
+
+void tdmaGetStats(TDMA_stats_t *stats)
+{
+    memset(stats, 0, sizeof(TDMA_stats_t));
+}
+
+#endif
@@ -0,0 +1,84 @@
+//
+//  tdma.h
+//  MRF49XA-Dongle
+//
+//  Created by the MRF49XA-Dongle contributors on 10/16/26.
+//  Copyright (c) 2026. All rights reserved.
+//
+
+#ifndef MRF49XA_Dongle_tdma_h
+#define MRF49XA_Dongle_tdma_h
+
+#include <stdint.h>
+#include "MRF49XA.h"
+#include "link.h"
+
+// Time slots for the packet modes, for networks with more than a couple of
+// dongles.
+//
+// Time is cut into superframes of slot count slots, each slot length ticks
+// long.  Every dongle has a slot, and only starts frames in its own, when
+// they'll be done before the slot ends (less TDMA_GUARD ticks).  The
+// coordinator has slot 0, and starts it with a beacon, a link frame with
+// LINK_BEACON set and the slot length, slot count and a sequence number
+// after the link header.  The others line their slots up with the beacon,
+// and take their slot length and count from it.  One that hasn't heard a
+// beacon for TDMA_BEACONS_LOST superframes stops sending until it does.
+//
+// The TDMA register (B in the register menu) is
+//   bits 15-12  Slot length, in units of 4 ticks (0 is TDMA_SLOT_DEFAULT)
+//   bits 11-8   Slot count, 2 to 15 (0 or 1 is TDMA_SLOTS_DEFAULT)
+//   bits 7-4    Our slot, 0 for the coordinator
+//   bit  0      TDMA on
+//
+// A slot should be long enough for the longest frame at the bit rate in
+// use.  A frame that won't fit in a whole slot goes at the start of one
+// anyway.  There's no contention within a slot, so CSMA can stay off.
+// The slots only run in the packet modes, which handle the beacons.  In
+// the other modes the transmit window is left open.
+//
+// ARQ, rate and FEC adaptation only keep state for one other dongle, so
+// they're turned off while this is on, whatever the link options say.
+// A dongle isn't in step when the schedule is set, and doesn't send
+// until it hears a beacon (the coordinator excepted).
+#define TDMA_BEACON_LEN         (LINK_HEADER_LEN + 3)
+
+#define TDMA_SLOT_DEFAULT       16      // Ticks (8.192 mS each)
+#define TDMA_SLOTS_DEFAULT      4
+#define TDMA_SLOTS_MAX          15
+#define TDMA_GUARD              2       // Ticks left quiet at the end of a slot
+#define TDMA_BEACON_DELAY       1       // Ticks a beacon takes to arrive
+#define TDMA_BEACONS_LOST       4
+
+#define TDMA_REG_ENABLE         0x0001
+#define TDMA_REG_SLOT(reg)      (((reg) >> 4) & 0x0F)
+#define TDMA_REG_SLOTS(reg)     (((reg) >> 8) & 0x0F)
+#define TDMA_REG_LENGTH(reg)    (((reg) >> 12) << 2)
+
+typedef struct {
+    uint8_t  slot;          // Slot the superframe is in now
+    uint8_t  synced;        // We've heard a beacon lately (or we send them)
+    uint16_t beaconsSent;
+    uint16_t beaconsHeard;
+} TDMA_stats_t;
+
+void    tdmaConfigure(uint16_t reg);
+uint8_t tdmaEnabled(void);
+
+// Entering and leaving the packet modes
+void    tdmaStart(void);
+void    tdmaStop(void);
+
+// Call from the 8.192 mS timer ISR
+void tdmaTick(void);
+
+// The next received packet, after any beacons have been dealt with.
+// Valid until the next call.
+MRF_packet_t* tdmaReceive(void);
+
+// Sends the coordinator's beacons, call this often from the main loop
+void tdmaPoll(void);
+
+void tdmaGetStats(TDMA_stats_t *stats);
+
+#endif
@@ -9,6 +9,7 @@
 #include "hardware.h"
 #include "utilities.h"
 #include <avr/wdt.h>
+#include <avr/interrupt.h>
 #include <avr/io.h>
 #include <util/delay.h>
 #include <LUFA/Common/Common.h>
@@ -200,4 +201,16 @@ void jumpToBootloader(void)
     for (;;);
 }
 
-
+// The tick counter is changed by the timer ISR, so it can't be read in
+// two pieces
+uint16_t getTicks(void)
+{
+    extern volatile uint16_t ticks;
+    
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t now = ticks;
+    SREG = sreg;
+    
+    return now;
+}
@@ -21,6 +21,8 @@ void print_dec(uint16_t value);
 
 void jumpToBootloader(void);
 
+uint16_t getTicks(void);    // The 8.192 mS tick counter, read safely
+
 void setFlowControl_start(void);
 void setFlowControl_stop(void);
 